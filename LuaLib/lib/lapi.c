@@ -400,6 +400,18 @@ LUA_API void *lua_touserdata (lua_State *L, int idx) {
 }
 
 
+LUA_API void *lua_totypedarray (lua_State *L, int idx, int *atype,
+                                size_t *n) {
+  StkId o = index2adr(L, idx);
+  Udata *u;
+  if (!istypedarray(o)) return NULL;
+  u = rawuvalue(o);
+  if (atype) *atype = u->uv.atype;
+  if (n) *n = u->uv.len / tasize(u->uv.atype);
+  return u + 1;
+}
+
+
 LUA_API lua_State *lua_tothread (lua_State *L, int idx) {
   StkId o = index2adr(L, idx);
   return (!ttisthread(o)) ? NULL : thvalue(o);
@@ -459,6 +471,23 @@ LUA_API void lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** pushes the `len' characters from position `i' (0-based) of the string
+** at `idx'; may share the contents of that string instead of copying
+*/
+LUA_API void lua_pushsubstring (lua_State *L, int idx, size_t i, size_t len) {
+  StkId o;
+  lua_lock(L);
+  luaC_checkGC(L);  /* (may shrink the stack, so before `index2adr') */
+  o = index2adr(L, idx);
+  api_check(L, ttisstring(o));
+  api_check(L, i <= tsvalue(o)->len && len <= tsvalue(o)->len - i);
+  setsvalue2s(L, L->top, luaS_sub(L, rawtsvalue(o), i, len));
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_pushstring (lua_State *L, const char *s) {
   if (s == NULL)
     lua_pushnil(L);
@@ -877,20 +906,38 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
   lua_lock(L);
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname);
+  status = luaD_protectedparser(L, &z, chunkname, 0);
   lua_unlock(L);
   return status;
 }
 
 
-LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
+/*
+** load a chunk from a block of memory that stays unchanged while any
+** function created from it lives; the code of an image (see
+** `lua_dumpimage') is then used in place, not copied
+*/
+LUA_API int lua_loadimage (lua_State *L, const char *image, size_t size,
+                           const char *chunkname) {
+  ZIO z;
+  int status;
+  lua_lock(L);
+  if (!chunkname) chunkname = "?";
+  luaZ_initblock(L, &z, image, size);
+  status = luaD_protectedparser(L, &z, chunkname, 1);
+  lua_unlock(L);
+  return status;
+}
+
+
+static int dump (lua_State *L, lua_Writer writer, void *data, int image) {
   int status;
   TValue *o;
   lua_lock(L);
   api_checknelems(L, 1);
   o = L->top - 1;
   if (isLfunction(o))
-    status = luaU_dump(L, clvalue(o)->l.p, writer, data, 0);
+    status = luaU_dump(L, clvalue(o)->l.p, writer, data, 0, image);
   else
     status = 1;
   lua_unlock(L);
@@ -898,6 +945,17 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
 }
 
 
+LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
+  return dump(L, writer, data, 0);
+}
+
+
+/* dump as an image, which `lua_loadimage' can use in place */
+LUA_API int lua_dumpimage (lua_State *L, lua_Writer writer, void *data) {
+  return dump(L, writer, data, 1);
+}
+
+
 LUA_API int  lua_status (lua_State *L) {
   return L->status;
 }
@@ -1000,6 +1058,28 @@ LUA_API int lua_next (lua_State *L, int idx) {
 }
 
 
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_rawmove (lua_State *L, int a1, int f, int e, int t,
+                          int a2) {
+  StkId o1, o2;
+  lua_lock(L);
+  o1 = index2adr(L, a1);
+  o2 = index2adr(L, a2);
+  api_check(L, ttistable(o1) && ttistable(o2));
+  luaH_move(L, hvalue(o1), f, e, hvalue(o2), t);
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_concat (lua_State *L, int n) {
   lua_lock(L);
   api_checknelems(L, n);
@@ -1047,6 +1127,43 @@ LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
 }
 
 
+/*
+** pushes a new string of `len' characters and returns its contents,
+** which the caller must fill before the string is used in any other
+** way. Only for long strings (`len' > LUAI_MAXSHORTLEN): short ones
+** are interned by contents, which must be known when they are created
+*/
+LUA_API char *lua_newstring (lua_State *L, size_t len) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, len > LUAI_MAXSHORTLEN);
+  luaC_checkGC(L);
+  ts = luaS_createlngstrobj(L, len);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  lua_unlock(L);
+  return cast(char *, ts + 1);
+}
+
+
+LUA_API void *lua_newtypedarray (lua_State *L, int atype, size_t n) {
+  Udata *u;
+  size_t esize;
+  lua_lock(L);
+  api_check(L, LUA_TAFLOAT64 <= atype && atype <= LUA_TAUINT8);
+  esize = tasize(atype);
+  if (n > MAX_SIZET / esize)
+    luaM_toobig(L);
+  luaC_checkGC(L);
+  u = luaS_newudata(L, n * esize, getcurrenv(L));
+  u->uv.atype = cast_byte(atype);
+  setuvalue(L, L->top, u);
+  api_incr_top(L);
+  lua_unlock(L);
+  return u + 1;
+}
+
+
 
 
 static const char *aux_upvalue (StkId fi, int n, TValue **val) {
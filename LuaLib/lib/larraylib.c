@@ -0,0 +1,326 @@
+/*
+** $Id: larraylib.c $
+** Library for Typed Arrays
+** See Copyright Notice in lua.h
+*/
+
+
+#include <string.h>
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** Elements are read and written with `a[i]' directly by the virtual
+** machine; this library only creates arrays and implements the bulk
+** operations. The kernels below are plain loops over one C array
+** (several accumulators for reductions), so that compilers can
+** vectorize them.
+*/
+
+
+typedef struct TArray {
+  void *p;
+  int type;  /* LUA_TA* */
+  size_t n;  /* number of elements */
+} TArray;
+
+
+static const char *const tanames[] = {
+  "float64", "float32", "int32", "uint8", NULL
+};
+
+
+static size_t elemsize (int type) {
+  switch (type) {
+    case LUA_TAFLOAT64: return sizeof(double);
+    case LUA_TAFLOAT32: return sizeof(float);
+    case LUA_TAINT32: return sizeof(LUAI_INT32);
+    default: return 1;
+  }
+}
+
+
+static TArray *toarray (lua_State *L, int arg, TArray *a) {
+  a->p = lua_totypedarray(L, arg, &a->type, &a->n);
+  return (a->p == NULL) ? NULL : a;
+}
+
+
+static TArray *checkarray (lua_State *L, int arg, TArray *a) {
+  if (toarray(L, arg, a) == NULL)
+    luaL_typerror(L, arg, LUA_ARRAYLIBNAME);
+  return a;
+}
+
+
+/*
+** reads the optional range [i, j] (1-based, inclusive) at `arg' and
+** `arg'+1; returns it as the 0-based [*i, *j)
+*/
+static void getrange (lua_State *L, const TArray *a, int arg,
+                      size_t *i, size_t *j) {
+  lua_Integer li = luaL_optinteger(L, arg, 1);
+  lua_Integer lj = luaL_optinteger(L, arg + 1, (lua_Integer)a->n);
+  luaL_argcheck(L, li >= 1, arg, "out of range");
+  luaL_argcheck(L, lj <= (lua_Integer)a->n, arg + 1, "out of range");
+  *i = (size_t)(li - 1);
+  *j = (lj < li) ? *i : (size_t)lj;
+}
+
+
+/* `stat' runs with `e' pointing to the elements (with their C type) */
+#define taswitch(a,stat) \
+  switch ((a)->type) { \
+    case LUA_TAFLOAT64: { double *e = (double *)(a)->p; stat; break; } \
+    case LUA_TAFLOAT32: { float *e = (float *)(a)->p; stat; break; } \
+    case LUA_TAINT32: { LUAI_INT32 *e = (LUAI_INT32 *)(a)->p; stat; break; } \
+    default: { unsigned char *e = (unsigned char *)(a)->p; stat; break; } \
+  }
+
+
+static void setfromnumber (TArray *a, size_t k, lua_Number v) {
+  int iv;
+  switch (a->type) {
+    case LUA_TAFLOAT64: ((double *)a->p)[k] = v; break;
+    case LUA_TAFLOAT32: ((float *)a->p)[k] = (float)v; break;
+    case LUA_TAINT32: {
+      lua_number2int(iv, v);
+      ((LUAI_INT32 *)a->p)[k] = iv;
+      break;
+    }
+    default: {
+      lua_number2int(iv, v);
+      ((unsigned char *)a->p)[k] = (unsigned char)iv;
+      break;
+    }
+  }
+}
+
+
+static lua_Number getnumber (const TArray *a, size_t k) {
+  taswitch(a, return (lua_Number)e[k]);
+  return 0;  /* to avoid warnings */
+}
+
+
+static void pusharray (lua_State *L, TArray *a, int type, size_t n) {
+  a->p = lua_newtypedarray(L, type, n);
+  a->type = type;
+  a->n = n;
+  luaL_getmetatable(L, LUA_ARRAYHANDLE);
+  lua_setmetatable(L, -2);
+}
+
+
+static int arr_new (lua_State *L) {
+  TArray a;
+  int type = luaL_checkoption(L, 1, NULL, tanames) + 1;
+  if (lua_istable(L, 2)) {  /* initialize from a table? */
+    size_t k;
+    size_t n = lua_objlen(L, 2);
+    pusharray(L, &a, type, n);
+    for (k = 0; k < n; k++) {
+      lua_rawgeti(L, 2, (int)(k + 1));
+      if (!lua_isnumber(L, -1))
+        luaL_error(L, "invalid value (%s) at index %d in table for "
+                      LUA_QL("new"), luaL_typename(L, -1), (int)(k + 1));
+      setfromnumber(&a, k, lua_tonumber(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    lua_Integer n = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n >= 0, 2, "size cannot be negative");
+    pusharray(L, &a, type, (size_t)n);
+    memset(a.p, 0, a.n * elemsize(type));
+  }
+  return 1;
+}
+
+
+static int arr_type (lua_State *L) {
+  TArray a;
+  if (toarray(L, 1, &a) == NULL)
+    lua_pushnil(L);
+  else
+    lua_pushstring(L, tanames[a.type - 1]);
+  return 1;
+}
+
+
+static int arr_fill (lua_State *L) {
+  TArray a;
+  size_t i, j, k;
+  lua_Number v;
+  checkarray(L, 1, &a);
+  v = luaL_checknumber(L, 2);
+  getrange(L, &a, 3, &i, &j);
+  if (i < j) {
+    setfromnumber(&a, i, v);  /* convert once... */
+    taswitch(&a, for (k = i + 1; k < j; k++) e[k] = e[i]);  /* ...and copy */
+  }
+  return 0;
+}
+
+
+/* a:copy(src [, t]): copies all elements of `src' to a[t..] */
+static int arr_copy (lua_State *L) {
+  TArray a, src;
+  lua_Integer t;
+  size_t k;
+  checkarray(L, 1, &a);
+  checkarray(L, 2, &src);
+  t = luaL_optinteger(L, 3, 1);
+  luaL_argcheck(L, t >= 1 && src.n <= a.n && (size_t)(t - 1) <= a.n - src.n,
+                3, "out of range");
+  if (a.type == src.type) {
+    size_t esize = elemsize(a.type);
+    memmove((char *)a.p + (size_t)(t - 1) * esize, src.p, src.n * esize);
+  }
+  else {  /* convert element by element */
+    for (k = 0; k < src.n; k++)
+      setfromnumber(&a, (size_t)(t - 1) + k, getnumber(&src, k));
+  }
+  return 0;
+}
+
+
+static int arr_sum (lua_State *L) {
+  TArray a;
+  size_t i, j;
+  lua_Number s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  checkarray(L, 1, &a);
+  getrange(L, &a, 2, &i, &j);
+  taswitch(&a,
+    for (; i + 4 <= j; i += 4) {
+      s0 += e[i]; s1 += e[i + 1]; s2 += e[i + 2]; s3 += e[i + 3];
+    }
+    for (; i < j; i++) s0 += e[i]
+  );
+  lua_pushnumber(L, (s0 + s1) + (s2 + s3));
+  return 1;
+}
+
+
+/* pushes the minimum (if `max' is 0) or the maximum of a range */
+static int minmax (lua_State *L, int max) {
+  TArray a;
+  size_t i, j;
+  lua_Number m0, m1, m2, m3;
+  checkarray(L, 1, &a);
+  getrange(L, &a, 2, &i, &j);
+  if (i >= j) return 0;  /* empty range: no result */
+  m0 = m1 = m2 = m3 = getnumber(&a, i);
+  if (max) {
+    taswitch(&a,
+      for (; i + 4 <= j; i += 4) {
+        if (e[i] > m0) m0 = e[i];
+        if (e[i + 1] > m1) m1 = e[i + 1];
+        if (e[i + 2] > m2) m2 = e[i + 2];
+        if (e[i + 3] > m3) m3 = e[i + 3];
+      }
+      for (; i < j; i++) if (e[i] > m0) m0 = e[i]
+    );
+    if (m1 > m0) m0 = m1;
+    if (m3 > m2) m2 = m3;
+    if (m2 > m0) m0 = m2;
+  }
+  else {
+    taswitch(&a,
+      for (; i + 4 <= j; i += 4) {
+        if (e[i] < m0) m0 = e[i];
+        if (e[i + 1] < m1) m1 = e[i + 1];
+        if (e[i + 2] < m2) m2 = e[i + 2];
+        if (e[i + 3] < m3) m3 = e[i + 3];
+      }
+      for (; i < j; i++) if (e[i] < m0) m0 = e[i]
+    );
+    if (m1 < m0) m0 = m1;
+    if (m3 < m2) m2 = m3;
+    if (m2 < m0) m0 = m2;
+  }
+  lua_pushnumber(L, m0);
+  return 1;
+}
+
+
+static int arr_min (lua_State *L) {
+  return minmax(L, 0);
+}
+
+
+static int arr_max (lua_State *L) {
+  return minmax(L, 1);
+}
+
+
+static int arr_totable (lua_State *L) {
+  TArray a;
+  size_t i, j, k;
+  checkarray(L, 1, &a);
+  getrange(L, &a, 2, &i, &j);
+  lua_createtable(L, (int)(j - i), 0);
+  for (k = i; k < j; k++) {
+    lua_pushnumber(L, getnumber(&a, k));
+    lua_rawseti(L, -2, (int)(k - i + 1));
+  }
+  return 1;
+}
+
+
+static int arr_len (lua_State *L) {
+  TArray a;
+  checkarray(L, 1, &a);
+  lua_pushinteger(L, (lua_Integer)a.n);
+  return 1;
+}
+
+
+static int arr_tostring (lua_State *L) {
+  TArray a;
+  checkarray(L, 1, &a);
+  lua_pushfstring(L, "%s array (%p)", tanames[a.type - 1], a.p);
+  return 1;
+}
+
+
+static const luaL_Reg arrlib[] = {
+  {"copy", arr_copy},
+  {"fill", arr_fill},
+  {"max", arr_max},
+  {"min", arr_min},
+  {"new", arr_new},
+  {"sum", arr_sum},
+  {"totable", arr_totable},
+  {"type", arr_type},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg arrmeta[] = {
+  {"__len", arr_len},
+  {"__tostring", arr_tostring},
+  {NULL, NULL}
+};
+
+
+/*
+** Open typed array library
+*/
+LUALIB_API int luaopen_array (lua_State *L) {
+  luaL_register(L, LUA_ARRAYLIBNAME, arrlib);
+  luaL_newmetatable(L, LUA_ARRAYHANDLE);  /* metatable for arrays */
+  luaL_register(L, NULL, arrmeta);
+  lua_pushvalue(L, -2);  /* library table */
+  lua_setfield(L, -2, "__index");  /* methods are the library functions */
+  lua_pop(L, 1);  /* pop metatable */
+  return 1;
+}
+
@@ -25,6 +25,14 @@
 #include "lauxlib.h"
 
 
+#if defined(LUA_USE_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
 #define FREELIST_REF	0	/* free list of references */
 
 
@@ -434,8 +442,18 @@ LUALIB_API char *luaL_prepbuffer (luaL_Buffer *B) {
 
 
 LUALIB_API void luaL_addlstring (luaL_Buffer *B, const char *s, size_t l) {
-  while (l--)
-    luaL_addchar(B, *s++);
+  while (l > 0) {  /* copy as much as fits in the buffer at a time */
+    size_t n = bufffree(B);
+    if (n == 0)
+      luaL_prepbuffer(B);
+    else {
+      if (n > l) n = l;
+      memcpy(B->p, s, n);
+      B->p += n;
+      s += n;
+      l -= n;
+    }
+  }
 }
 
 
@@ -590,6 +608,108 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
 }
 
 
+#if defined(LUA_USE_MMAP)
+/* true if `image' is a chunk image, whose code is used in place */
+static int isimage (const char *image, size_t size) {
+  size_t l = sizeof(LUA_SIGNATURE) - 1;
+  return size > l + 1 && memcmp(image, LUA_SIGNATURE, l) == 0 &&
+         image[l + 1] == LUA_IMAGEFORMAT;  /* (after the version) */
+}
+
+
+/* an image kept mapped for the whole process */
+typedef struct Mapped {
+  struct Mapped *next;
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  size_t size;
+  const char *image;
+} Mapped;
+
+static Mapped *mapped = NULL;  /* list of mapped images (all states) */
+
+
+/*
+** returns the mapping of the file described by `st', mapping it if
+** needed; a new mapping is kept only if it is an image
+*/
+static const char *mapfile (int fd, const struct stat *st, int *kept) {
+  Mapped *m;
+  const char *image;
+  size_t size = (size_t)st->st_size;
+  luai_cachelock();
+  for (m = mapped; m != NULL; m = m->next) {
+    if (m->dev == st->st_dev && m->ino == st->st_ino &&
+        m->mtime == st->st_mtime && m->size == size) {
+      luai_cacheunlock();
+      *kept = 1;
+      return m->image;
+    }
+  }
+  image = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  *kept = 0;
+  if (image != (const char *)MAP_FAILED && isimage(image, size) &&
+      (m = (Mapped *)malloc(sizeof(Mapped))) != NULL) {
+    m->dev = st->st_dev;
+    m->ino = st->st_ino;
+    m->mtime = st->st_mtime;
+    m->size = size;
+    m->image = image;
+    m->next = mapped;
+    mapped = m;
+    *kept = 1;
+  }
+  luai_cacheunlock();
+  return image;
+}
+#endif
+
+
+/*
+** loads a chunk mapped from a file. The code of an image (see
+** `lua_dumpimage') is used in place, so its mapping is kept for the
+** whole process and shared by all states that load the same file
+** (same device, inode, modification time and size). Replace an image
+** by renaming a new file over it: truncating or rewriting a file in
+** place breaks the mappings of its old contents (touching a truncated
+** page raises SIGBUS).
+*/
+LUALIB_API int luaL_loadimage (lua_State *L, const char *filename) {
+#if defined(LUA_USE_MMAP)
+  int status;
+  int fd;
+  int kept;
+  struct stat st;
+  const char *image;
+  int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+  lua_pushfstring(L, "@%s", filename);
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) return errfile(L, "open", fnameindex);
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return errfile(L, "read", fnameindex);
+  }
+  if (st.st_size == 0) {  /* cannot map an empty file */
+    close(fd);
+    lua_pop(L, 1);
+    return luaL_loadfile(L, filename);
+  }
+  image = mapfile(fd, &st, &kept);
+  close(fd);
+  if (image == (const char *)MAP_FAILED)
+    return errfile(L, "map", fnameindex);
+  status = lua_loadimage(L, image, (size_t)st.st_size, lua_tostring(L, -1));
+  if (!kept)  /* not an image? (its contents were copied) */
+    munmap((void *)image, (size_t)st.st_size);
+  lua_remove(L, fnameindex);
+  return status;
+#else
+  return luaL_loadfile(L, filename);
+#endif
+}
+
+
 typedef struct LoadS {
   const char *s;
   size_t size;
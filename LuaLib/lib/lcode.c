@@ -829,3 +829,222 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================
+** Optimizer: a pass over the code of a finished function that folds
+** comparisons between constants, threads jumps to jumps, and removes
+** unreachable code and jumps to the next instruction
+** =======================================================
+*/
+
+/* states of instructions for the optimizer */
+#define DEAD	0	/* unreachable */
+#define LIVE	1	/* reachable */
+#define KEPT	2	/* not executed, but part of another instruction */
+
+
+/*
+** marks as KEPT the words that are data of other instructions (SETLIST
+** counts, CLOSURE upvalue moves), which must not be decoded as code
+*/
+static void markdata (Proto *f, int n, lu_byte *state) {
+  int pc = 0;
+  while (pc < n) {
+    Instruction i = f->code[pc++];
+    int k = 0;
+    if (GET_OPCODE(i) == OP_SETLIST && GETARG_C(i) == 0)
+      k = 1;  /* count */
+    else if (GET_OPCODE(i) == OP_CLOSURE)
+      k = f->p[GETARG_Bx(i)]->nups;  /* upvalue moves */
+    for (; k > 0 && pc < n; k--)
+      state[pc++] = KEPT;
+  }
+}
+
+
+/*
+** replaces a comparison between constants (and its following jump) by
+** a jump: `JMP 1' skips the following jump, `JMP 0' falls into it
+*/
+static void foldcomparisons (Proto *f, int n, const lu_byte *state) {
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (state[pc] == KEPT) continue;  /* data */
+    if ((op == OP_EQ || op == OP_LT || op == OP_LE) &&
+        ISK(GETARG_B(i)) && ISK(GETARG_C(i))) {
+      const TValue *b = &f->k[INDEXK(GETARG_B(i))];
+      const TValue *c = &f->k[INDEXK(GETARG_C(i))];
+      int res;
+      if (op == OP_EQ)
+        res = luaO_rawequalObj(b, c);
+      else if (ttisnumber(b) && ttisnumber(c))
+        res = (op == OP_LT) ? luai_numlt(nvalue(b), nvalue(c))
+                            : luai_numle(nvalue(b), nvalue(c));
+      else continue;  /* strings use the locale; others raise errors */
+      lua_assert(GET_OPCODE(f->code[pc + 1]) == OP_JMP);
+      f->code[pc] = CREATE_ABx(OP_JMP, 0,
+                               MAXARG_sBx + (res != GETARG_A(i)));
+    }
+  }
+}
+
+
+#define isinstr(pc,n,state)	(0 <= (pc) && (pc) < (n) && (state)[pc] != KEPT)
+
+static void threadjumps (Proto *f, int n, const lu_byte *state) {
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    if (state[pc] != KEPT && GET_OPCODE(f->code[pc]) == OP_JMP) {
+      int dest = pc + 1 + GETARG_sBx(f->code[pc]);
+      int count;
+      if (!isinstr(dest, n, state)) continue;
+      for (count = 0;  /* (count avoids looping forever on a cycle) */
+           count < n && GET_OPCODE(f->code[dest]) == OP_JMP;
+           count++) {
+        int next = dest + 1 + GETARG_sBx(f->code[dest]);
+        if (!isinstr(next, n, state)) break;
+        dest = next;
+      }
+      SETARG_sBx(f->code[pc], dest - (pc + 1));
+    }
+  }
+}
+
+
+/* true if instruction `i' may skip the next one */
+static int skipsnext (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return testTMode(op) || op == OP_TFORLOOP ||
+         (op == OP_LOADBOOL && GETARG_C(i));
+}
+
+
+/* marks as LIVE all instructions reachable from the entry point */
+static void markreachable (Proto *f, int n, lu_byte *state, int *stack) {
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    int pc = stack[--top];
+    while (pc < n && state[pc] == DEAD) {  /* follow a straight line */
+      Instruction i = f->code[pc];
+      state[pc] = LIVE;
+      switch (GET_OPCODE(i)) {
+        case OP_JMP: case OP_FORPREP:
+          pc += 1 + GETARG_sBx(i);
+          break;
+        case OP_FORLOOP:
+          stack[top++] = pc + 1 + GETARG_sBx(i);
+          pc++;
+          break;
+        case OP_RETURN:
+          pc = n;  /* end of this line */
+          break;
+        case OP_LOADBOOL:
+          pc += GETARG_C(i) ? 2 : 1;
+          break;
+        case OP_SETLIST:
+          pc += (GETARG_C(i) == 0) ? 2 : 1;  /* skip count */
+          break;
+        case OP_CLOSURE:
+          pc += 1 + f->p[GETARG_Bx(i)]->nups;  /* skip upvalue moves */
+          break;
+        default:
+          if (skipsnext(i))  /* test or TFORLOOP? */
+            stack[top++] = pc + 2;
+          pc++;
+          break;
+      }
+    }
+  }
+}
+
+
+/* marks the words that are parts of other instructions as KEPT */
+static void markparts (Proto *f, int n, lu_byte *state) {
+  int pc, k;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if (state[pc] != LIVE) continue;
+    switch (GET_OPCODE(i)) {
+      case OP_LOADBOOL:
+        if (GETARG_C(i) && state[pc + 1] == DEAD) {  /* skipped, not used? */
+          state[pc + 1] = KEPT;  /* keep a placeholder */
+          f->code[pc + 1] = CREATE_ABx(OP_JMP, 0, MAXARG_sBx);
+        }
+        break;
+      case OP_SETLIST:
+        if (GETARG_C(i) == 0)
+          state[pc + 1] = KEPT;  /* count */
+        break;
+      case OP_CLOSURE:
+        for (k = 1; k <= f->p[GETARG_Bx(i)]->nups; k++)
+          state[pc + k] = KEPT;  /* upvalue moves */
+        break;
+      case OP_JMP:  /* jump to next instruction, not needed by a skip? */
+        if (GETARG_sBx(i) == 0 && pc < n - 1 &&
+            !(pc > 0 && state[pc - 1] == LIVE && skipsnext(f->code[pc - 1])))
+          state[pc] = DEAD;
+        break;
+      default: break;
+    }
+  }
+  state[n - 1] = LIVE;  /* final return must stay */
+}
+
+
+/* removes DEAD instructions, correcting jumps, lines, and local scopes */
+static void compact (FuncState *fs, lu_byte *state, int *newpc) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int pc, j = 0;
+  for (pc = 0; pc < n; pc++) {
+    newpc[pc] = j;  /* (DEAD ones go to the next instruction kept) */
+    if (state[pc] != DEAD) j++;
+  }
+  newpc[n] = j;
+  if (j == n) return;  /* nothing to remove */
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if (state[pc] == DEAD) continue;
+    if (state[pc] == LIVE) {
+      OpCode op = GET_OPCODE(i);
+      if (op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP) {
+        int dest = newpc[pc + 1 + GETARG_sBx(i)];
+        SETARG_sBx(i, dest - (newpc[pc] + 1));
+      }
+    }
+    f->code[newpc[pc]] = i;
+    f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+  }
+  for (pc = 0; pc < fs->nlocvars; pc++) {
+    f->locvars[pc].startpc = newpc[f->locvars[pc].startpc];
+    f->locvars[pc].endpc = newpc[f->locvars[pc].endpc];
+  }
+  fs->pc = j;
+}
+
+
+void luaK_optimize (FuncState *fs) {
+  lua_State *L = fs->L;
+  Proto *f = fs->f;
+  int n = fs->pc;
+  lu_byte *state = luaM_newvector(L, n, lu_byte);
+  int *aux = luaM_newvector(L, n + 1, int);  /* stack, then new pcs */
+  int pc;
+  for (pc = 0; pc < n; pc++) state[pc] = DEAD;
+  markdata(f, n, state);
+  foldcomparisons(f, n, state);
+  threadjumps(f, n, state);
+  for (pc = 0; pc < n; pc++) state[pc] = DEAD;
+  markreachable(f, n, state, aux);
+  markparts(f, n, state);
+  compact(fs, state, aux);
+  luaM_freearray(L, state, n, lu_byte);
+  luaM_freearray(L, aux, n + 1, int);
+}
+
+/* }====================================================== */
@@ -485,9 +485,160 @@ int luaD_pcall (lua_State *L, Pfunc func, void *u,
 struct SParser {  /* data to `f_parser' */
   ZIO *z;
   Mbuffer buff;  /* buffer to be used by the scanner */
+  Mbuffer src;  /* whole source, for the compile cache */
   const char *name;
+  int image;  /* `z' is a chunk image in memory? */
 };
 
+
+#if defined(LUA_USE_CODECACHE)
+
+/*
+** {======================================================
+** Compile cache: a process-wide table from chunk (name and source) to
+** its code dumped as an image, so that loading the same source again
+** only undumps it, using its code in place. Entries are immutable and
+** never removed, so they can be used outside the lock; they live in
+** memory from `malloc', as they outlive the states that create them.
+** =======================================================
+*/
+
+#define CACHEBUCKETS	256
+
+typedef struct CacheEntry {
+  struct CacheEntry *next;
+  unsigned int h;  /* hash of name and source */
+  size_t lname, lsrc, lcode;
+  char *code;  /* dumped code */
+  char data[1];  /* name followed by source */
+} CacheEntry;
+
+static CacheEntry *cache[CACHEBUCKETS];
+static size_t cachesize = 0;  /* total size of entries */
+
+
+typedef struct DumpBuf {
+  char *b;
+  size_t n;
+  size_t size;
+} DumpBuf;
+
+
+static int writeblock (lua_State *L, const void *b, size_t size, void *ud) {
+  DumpBuf *d = cast(DumpBuf *, ud);
+  UNUSED(L);
+  if (size > d->size - d->n) {  /* must grow? */
+    size_t newsize = d->size * 2 + size;
+    char *nb = cast(char *, realloc(d->b, newsize));
+    if (nb == NULL) return 1;  /* error: give up caching */
+    d->b = nb;
+    d->size = newsize;
+  }
+  memcpy(d->b + d->n, b, size);
+  d->n += size;
+  return 0;
+}
+
+
+static CacheEntry *findentry (CacheEntry *e, unsigned int h,
+                              const char *name, size_t lname,
+                              const char *s, size_t l) {
+  for (; e != NULL; e = e->next) {
+    if (e->h == h && e->lname == lname && e->lsrc == l &&
+        memcmp(e->data, name, lname) == 0 &&
+        memcmp(e->data + lname, s, l) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+
+static void addentry (lua_State *L, Proto *tf, unsigned int h,
+                      const char *name, size_t lname,
+                      const char *s, size_t l) {
+  DumpBuf d;
+  CacheEntry *e;
+  CacheEntry **bucket = &cache[h % CACHEBUCKETS];
+  size_t esize = sizeof(CacheEntry) + lname + l;
+  d.b = NULL; d.n = d.size = 0;
+  if (luaU_dump(L, tf, writeblock, &d, 0, 1) != 0 ||
+      (e = cast(CacheEntry *, malloc(esize))) == NULL) {
+    free(d.b);
+    return;
+  }
+  e->h = h;
+  e->lname = lname;
+  e->lsrc = l;
+  e->lcode = d.n;
+  e->code = d.b;
+  memcpy(e->data, name, lname);
+  memcpy(e->data + lname, s, l);
+  luai_cachelock();
+  if (cachesize + esize + d.n > LUAI_MAXCODECACHE ||  /* cache full? */
+      findentry(*bucket, h, name, lname, s, l) != NULL) {  /* or added? */
+    luai_cacheunlock();
+    free(e->code);
+    free(e);
+    return;
+  }
+  e->next = *bucket;
+  *bucket = e;
+  cachesize += esize + d.n;
+  luai_cacheunlock();
+}
+
+
+/* reads all remaining input from `z' into `b'; returns its size */
+static size_t readall (lua_State *L, ZIO *z, Mbuffer *b) {
+  size_t n = 0;
+  while (luaZ_lookahead(z) != EOZ) {
+    if (z->n > luaZ_sizebuffer(b) - n) {
+      size_t newsize = luaZ_sizebuffer(b) * 2 + z->n;
+      if (newsize < n)  /* overflow? */
+        luaM_toobig(L);
+      luaZ_resizebuffer(L, b, newsize);
+    }
+    memcpy(luaZ_buffer(b) + n, z->p, z->n);
+    n += z->n;
+    z->p += z->n;
+    z->n = 0;
+  }
+  return n;
+}
+
+
+static Proto *parsesource (lua_State *L, struct SParser *p) {
+  size_t l = readall(L, p->z, &p->src);
+  const char *s = luaZ_buffer(&p->src);
+  size_t lname = strlen(p->name);
+  unsigned int h = luaS_hash(s, l, luaS_hash(p->name, lname, 0));
+  CacheEntry *e;
+  ZIO z;
+  luai_cachelock();
+  e = findentry(cache[h % CACHEBUCKETS], h, p->name, lname, s, l);
+  luai_cacheunlock();
+  if (e != NULL) {  /* hit? */
+    luaZ_initblock(L, &z, e->code, e->lcode);
+    return luaU_undump(L, &z, &p->buff, p->name, 1);
+  }
+  else {
+    Proto *tf;
+    luaZ_initblock(L, &z, s, l);
+    tf = luaY_parser(L, &z, &p->buff, p->name);
+    addentry(L, tf, h, p->name, lname, s, l);
+    return tf;
+  }
+}
+
+/* }====================================================== */
+
+#else
+
+#define parsesource(L,p)	luaY_parser(L, (p)->z, &(p)->buff, (p)->name)
+
+#endif
+
+
 static void f_parser (lua_State *L, void *ud) {
   int i;
   Proto *tf;
@@ -495,8 +646,9 @@ static void f_parser (lua_State *L, void *ud) {
   struct SParser *p = cast(struct SParser *, ud);
   int c = luaZ_lookahead(p->z);
   luaC_checkGC(L);
-  tf = ((c == LUA_SIGNATURE[0]) ? luaU_undump : luaY_parser)(L, p->z,
-                                                             &p->buff, p->name);
+  tf = (c == LUA_SIGNATURE[0])
+       ? luaU_undump(L, p->z, &p->buff, p->name, p->image)
+       : parsesource(L, p);
   cl = luaF_newLclosure(L, tf->nups, hvalue(gt(L)));
   cl->l.p = tf;
   for (i = 0; i < tf->nups; i++)  /* initialize eventual upvalues */
@@ -506,13 +658,16 @@ static void f_parser (lua_State *L, void *ud) {
 }
 
 
-int luaD_protectedparser (lua_State *L, ZIO *z, const char *name) {
+int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
+                          int image) {
   struct SParser p;
   int status;
-  p.z = z; p.name = name;
+  p.z = z; p.name = name; p.image = image;
   luaZ_initbuffer(L, &p.buff);
+  luaZ_initbuffer(L, &p.src);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
+  luaZ_freebuffer(L, &p.src);
   return status;
 }
 
@@ -20,6 +20,8 @@ typedef struct {
  lua_Writer writer;
  void* data;
  int strip;
+ int image;
+ size_t pos;				/* bytes written so far */
  int status;
 } DumpState;
 
@@ -33,6 +35,7 @@ static void DumpBlock(const void* b, size_t size, DumpState* D)
   lua_unlock(D->L);
   D->status=(*D->writer)(D->L,b,size,D->data);
   lua_lock(D->L);
+  D->pos+=size;
  }
 }
 
@@ -52,9 +55,20 @@ static void DumpNumber(lua_Number x, DumpState* D)
  DumpVar(x,D);
 }
 
+/* pad an image so that the next vector is aligned */
+static void DumpPad(DumpState* D)
+{
+ if (D->image)
+ {
+  static const char pad[LUAC_IMAGEALIGN]={0};
+  DumpBlock(pad,(0-D->pos)&(LUAC_IMAGEALIGN-1),D);
+ }
+}
+
 static void DumpVector(const void* b, int n, size_t size, DumpState* D)
 {
  DumpInt(n,D);
+ DumpPad(D);
  DumpMem(b,n,size,D);
 }
 
@@ -105,7 +119,13 @@ static void DumpConstants(const Proto* f, DumpState* D)
  }
  n=f->sizep;
  DumpInt(n,D);
- for (i=0; i<n; i++) DumpFunction(f->p[i],f->source,D);
+ for (i=0; i<n; i++)
+ {
+  const Proto* p=f->p[i];
+  if (p->lazy)				/* not loaded yet? */
+   p=luaU_loadnested(D->L,cast(Proto*,f),i);
+  DumpFunction(p,f->source,D);
+ }
 }
 
 static void DumpDebug(const Proto* f, DumpState* D)
@@ -144,19 +164,23 @@ static void DumpHeader(DumpState* D)
 {
  char h[LUAC_HEADERSIZE];
  luaU_header(h);
+ if (D->image) h[LUAC_FORMATOFFSET]=LUAC_IMAGEFORMAT;
  DumpBlock(h,LUAC_HEADERSIZE,D);
 }
 
 /*
-** dump Lua function as precompiled chunk
+** dump Lua function as precompiled chunk; an image pads the code and line
+** info of each function so that they can be loaded in place
 */
-int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip)
+int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, int image)
 {
  DumpState D;
  D.L=L;
  D.writer=w;
  D.data=data;
  D.strip=strip;
+ D.image=image;
+ D.pos=0;
  D.status=0;
  DumpHeader(&D);
  DumpFunction(f,NULL,&D);
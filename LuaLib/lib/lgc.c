@@ -37,7 +37,9 @@
 #define white2gray(x)	reset2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
 #define black2gray(x)	resetbit((x)->gch.marked, BLACKBIT)
 
-#define stringmark(s)	reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT)
+#define markstr(s)	reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT)
+#define stringmark(s)  \
+	(markstr(s), isview(s) ? (void)markstr(strview(s)->parent) : (void)0)
 
 
 #define isfinalized(u)		testbit((u)->marked, FINALIZEDBIT)
@@ -71,6 +73,8 @@ static void reallymarkobject (global_State *g, GCObject *o) {
   white2gray(o);
   switch (o->gch.tt) {
     case LUA_TSTRING: {
+      if (isview(rawgco2ts(o)))  /* keep its contents alive */
+        markobject(g, strview(rawgco2ts(o))->parent);
       return;
     }
     case LUA_TUSERDATA: {
@@ -387,7 +391,8 @@ static void freeobj (lua_State *L, GCObject *o) {
       break;
     }
     case LUA_TSTRING: {
-      G(L)->strt.nuse--;
+      if (isshortstr(rawgco2ts(o)))  /* long strings are not in `strt' */
+        G(L)->strt.nuse--;
       luaM_freemem(L, o, sizestring(gco2ts(o)));
       break;
     }
@@ -487,6 +492,8 @@ void luaC_freeall (lua_State *L) {
   sweepwholelist(L, &g->rootgc);
   for (i = 0; i < g->strt.size; i++)  /* free all string lists */
     sweepwholelist(L, &g->strt.hash[i]);
+  for (i = 0; i < g->strt.oldsize; i++)  /* (including a pending resize) */
+    sweepwholelist(L, &g->strt.oldhash[i]);
 }
 
 
@@ -571,8 +578,13 @@ static l_mem singlestep (lua_State *L) {
     }
     case GCSsweepstring: {
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      stringtable *tb = &g->strt;
+      /* buckets of a pending resize are swept after the new ones */
+      if (g->sweepstrgc < tb->size)
+        sweepwholelist(L, &tb->hash[g->sweepstrgc]);
+      else
+        sweepwholelist(L, &tb->oldhash[g->sweepstrgc - tb->size]);
+      if (++g->sweepstrgc >= tb->size + tb->oldsize)  /* nothing more? */
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
@@ -581,12 +593,12 @@ static l_mem singlestep (lua_State *L) {
     case GCSsweep: {
       lu_mem old = g->totalbytes;
       g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
+      lua_assert(old >= g->totalbytes);
+      g->estimate -= old - g->totalbytes;
       if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
-        checkSizes(L);
+        checkSizes(L);  /* (may allocate a new string array) */
         g->gcstate = GCSfinalize;  /* end sweep phase */
       }
-      lua_assert(old >= g->totalbytes);
-      g->estimate -= old - g->totalbytes;
       return GCSWEEPMAX*GCSWEEPCOST;
     }
     case GCSfinalize: {
@@ -613,6 +625,8 @@ void luaC_step (lua_State *L) {
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
+  if (g->strt.oldhash != NULL)  /* string table being resized? */
+    luaS_rehashstep(L, GCSWEEPMAX);
   do {
     lim -= singlestep(L);
     if (g->gcstate == GCSpause)
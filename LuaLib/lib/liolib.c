@@ -416,8 +416,9 @@ static int g_write (lua_State *L, FILE *f, int arg) {
   for (; nargs--; arg++) {
     if (lua_type(L, arg) == LUA_TNUMBER) {
       /* optimization: could be done exactly as for strings */
-      status = status &&
-          fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg)) > 0;
+      char s[LUAI_MAXNUMBER2STR];
+      lua_number2str(s, lua_tonumber(L, arg));
+      status = status && fputs(s, f) >= 0;
     }
     else {
       size_t l;
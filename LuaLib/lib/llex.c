@@ -122,6 +122,8 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* make sure `str' will not be collected */
     luaC_checkGC(L);
   }
+  else  /* string already present; reuse the (anchored) one in the table */
+    ts = rawtsvalue(key2tval(cast(Node *, o)));  /* `i_val' is first in Node */
   return ts;
 }
 
@@ -111,11 +111,29 @@ typedef lu_int32 Instruction;
 #define lua_unlock(L)   ((void) 0)
 #endif
 
+/* maximum total size of the compile cache */
+#ifndef LUAI_MAXCODECACHE
+#define LUAI_MAXCODECACHE	(64*1024*1024)
+#endif
+
 #ifndef luai_threadyield
 #define luai_threadyield(L)     {lua_unlock(L); lua_lock(L);}
 #endif
 
 
+/*
+** hint to bring a cache line in before it is needed (e.g. the next node
+** of a hash chain while the current one is being compared)
+*/
+#ifndef luai_prefetch
+#if defined(__GNUC__) && !defined(LUA_ANSI)
+#define luai_prefetch(p)	__builtin_prefetch(p)
+#else
+#define luai_prefetch(p)	((void)(p))
+#endif
+#endif
+
+
 /*
 ** macro to control inclusion of some hard tests on stack reallocation
 */ 
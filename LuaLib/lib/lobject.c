@@ -5,6 +5,7 @@
 */
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -80,6 +81,8 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
     case LUA_TLIGHTUSERDATA:
       return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING:
+      return luaS_eqstr(rawtsvalue(t1), rawtsvalue(t2));
     default:
       lua_assert(iscollectable(t1));
       return gcvalue(t1) == gcvalue(t2);
@@ -87,8 +90,27 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
 }
 
 
+/* integers up to this (exclusive) have at most 15 digits, all exact */
+#define MAXFASTINT	1e15
+
 int luaO_str2d (const char *s, lua_Number *result) {
   char *endptr;
+  const char *p = s;
+  while (isspace(cast(unsigned char, *p))) p++;
+  if (*p == '-' || *p == '+') p++;
+  if (isdigit(cast(unsigned char, *p))) {  /* try a plain integer first */
+    lua_Number a = 0;
+    int nd = 0;
+    do {
+      a = a * 10 + (*p++ - '0');
+    } while (isdigit(cast(unsigned char, *p)) && ++nd < 15);
+    while (isspace(cast(unsigned char, *p))) p++;
+    if (*p == '\0') {  /* nothing else? (15 digits at most) */
+      while (isspace(cast(unsigned char, *s))) s++;
+      *result = (*s == '-') ? -a : a;
+      return 1;
+    }
+  }
   *result = lua_str2number(s, &endptr);
   if (endptr == s) return 0;  /* conversion failed */
   if (*endptr == 'x' || *endptr == 'X')  /* maybe an hexadecimal constant? */
@@ -101,6 +123,40 @@ int luaO_str2d (const char *s, lua_Number *result) {
 
 
 
+/* integral values below this (exclusive) are written by `luaO_num2str' */
+#define MAXNUM2STRINT \
+  ((cast_num(ULONG_MAX) < 1e14) ? cast_num(ULONG_MAX) : 1e14)
+
+/*
+** converts a number to a string as `lua_number2str', returning its
+** length; integral values (common) below 1e14 print with no exponent in
+** every format, so they are written directly
+*/
+int luaO_num2str (char *s, lua_Number n) {
+  lua_Number a = (n < 0) ? -n : n;
+  if (a < MAXNUM2STRINT && a == cast_num((unsigned long)a) &&
+      (n != 0 || 1/n > 0)) {  /* (-0 must be written as such) */
+    char buff[LUAI_MAXNUMBER2STR];
+    char *p = buff + LUAI_MAXNUMBER2STR;
+    unsigned long u = (unsigned long)a;
+    int l;
+    do {  /* write digits backwards */
+      *--p = cast(char, '0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    if (n < 0) *--p = '-';
+    l = cast_int(buff + LUAI_MAXNUMBER2STR - p);
+    memcpy(s, p, l);
+    s[l] = '\0';
+    return l;
+  }
+  else {
+    lua_number2str(s, n);
+    return cast_int(strlen(s));
+  }
+}
+
+
 static void pushstr (lua_State *L, const char *str) {
   setsvalue2s(L, L->top, luaS_new(L, str));
   incr_top(L);
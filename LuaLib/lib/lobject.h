@@ -201,13 +201,32 @@ typedef union TString {
   struct {
     CommonHeader;
     lu_byte reserved;
+    lu_byte extra;  /* long strings: STRHASHED and STRVIEW bits */
     unsigned int hash;
     size_t len;
   } tsv;
 } TString;
 
 
-#define getstr(ts)	cast(const char *, (ts) + 1)
+/* bits in `extra' of long strings */
+#define STRHASHED	1	/* `hash' has been computed */
+#define STRVIEW		2	/* contents are a suffix of another string */
+
+/*
+** A view (a long suffix of a long string, see `luaS_sub') keeps this
+** after its header instead of its characters. Being a suffix, its
+** contents share the ending 0 of the parent.
+*/
+typedef struct StrView {
+  union TString *parent;  /* string holding the contents (never a view) */
+  const char *s;  /* contents */
+} StrView;
+
+#define strview(ts)	cast(StrView *, (ts) + 1)
+#define isview(ts)	((ts)->tsv.extra & STRVIEW)
+
+#define getstr(ts)  \
+	(isview(ts) ? strview(ts)->s : cast(const char *, (ts) + 1))
 #define svalue(o)       getstr(rawtsvalue(o))
 
 
@@ -216,6 +235,7 @@ typedef union Udata {
   L_Umaxalign dummy;  /* ensures maximum alignment for `local' udata */
   struct {
     CommonHeader;
+    lu_byte atype;  /* element type if this is a typed array */
     struct Table *metatable;
     struct Table *env;
     size_t len;
@@ -223,6 +243,18 @@ typedef union Udata {
 } Udata;
 
 
+/*
+** Typed arrays are userdata whose block is a plain C array of `len' /
+** tasize(atype) elements, indexed directly by the virtual machine
+*/
+#define istypedarray(o)	(ttisuserdata(o) && uvalue(o)->atype != LUA_TANONE)
+
+#define tasize(t) \
+	((t) == LUA_TAFLOAT64 ? sizeof(double) : \
+	 (t) == LUA_TAFLOAT32 ? sizeof(float) : \
+	 (t) == LUA_TAINT32 ? sizeof(LUAI_INT32) : 1)
+
+
 
 
 /*
@@ -237,6 +269,8 @@ typedef struct Proto {
   struct LocVar *locvars;  /* information about local variables */
   TString **upvalues;  /* upvalue names */
   TString  *source;
+  const char *lazy;  /* if not loaded yet, its place in a chunk image */
+  size_t sizelazy;
   int sizeupvalues;
   int sizek;  /* size of `k' */
   int sizecode;
@@ -250,6 +284,7 @@ typedef struct Proto {
   lu_byte numparams;
   lu_byte is_vararg;
   lu_byte maxstacksize;
+  lu_byte inimage;  /* `code' and `lineinfo' point into a chunk image */
 } Proto;
 
 
@@ -345,6 +380,8 @@ typedef struct Table {
   Node *lastfree;  /* any free position is before this position */
   GCObject *gclist;
   int sizearray;  /* size of `array' array */
+  int lastnext;  /* node index of the last key returned by `next' */
+  int lastborder;  /* last border found in the array part by `luaH_getn' */
 } Table;
 
 
@@ -378,6 +415,7 @@ LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+LUAI_FUNC int luaO_num2str (char *s, lua_Number n);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
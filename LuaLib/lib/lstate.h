@@ -39,6 +39,9 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  /* number of elements */
   int size;
+  GCObject **oldhash;  /* previous array while a resize is in progress */
+  int oldsize;
+  int rehashpos;  /* next bucket of `oldhash' to be moved */
 } stringtable;
 
 
@@ -69,6 +72,7 @@ typedef struct global_State {
   stringtable strt;  /* hash table for strings */
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to `frealloc' */
+  unsigned int seed;  /* randomized seed for string hashes */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   int sweepstrgc;  /* position of sweep in `strt' */
@@ -18,6 +18,18 @@
 #include "lstring.h"
 
 
+/*
+** Resizing is incremental: luaS_resize only installs the new array and
+** keeps the old one in `oldhash'; its buckets are then moved a few at a
+** time, at each string lookup and at each GC step, so that crossing a
+** size threshold with millions of strings does not stall the program.
+** Until it is done, a string may be in either array. Buckets are not
+** moved while the collector sweeps the string table.
+*/
+
+#define REHASHSTEP	8	/* buckets moved per string lookup */
+
+
 /*
  重新分配hash表大小
 */
@@ -27,38 +39,127 @@ void luaS_resize (lua_State *L, int newsize) {
   int i;
   if (G(L)->gcstate == GCSsweepstring)
     return;  /* cannot resize during GC traverse */
+  tb = &G(L)->strt;
+  luaS_rehashstep(L, MAX_INT);  /* finish a previous resize */
 	//创建新空间
   newhash = luaM_newvector(L, newsize, GCObject *);
-  tb = &G(L)->strt;
 	//初始化
   for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash 把老的hash表里的值换到新hash表中*/
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
+  /* old array is rehashed by `luaS_rehashstep' 老的hash表里的值以后逐步换到新hash表中*/
+  tb->oldhash = tb->hash;
+  tb->oldsize = tb->size;
+  tb->rehashpos = 0;
+  tb->size = newsize;
+  tb->hash = newhash;
+  if (tb->oldsize == 0)  /* nothing to move? */
+    luaS_rehashstep(L, 0);  /* just release old array */
+}
+
+
+/*
+** moves (at most) `n' buckets from the old array to the new one
+*/
+void luaS_rehashstep (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->oldhash == NULL || G(L)->gcstate == GCSsweepstring)
+    return;  /* no resize in progress or cannot move strings now */
+  for (; n > 0 && tb->rehashpos < tb->oldsize; n--) {
+    GCObject *p = tb->oldhash[tb->rehashpos];
+    tb->oldhash[tb->rehashpos++] = NULL;
 		//循环冲突节点
     while (p) {  /* for each node in the list */
       GCObject *next = p->gch.next;  /* save next */
       unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position 根据hash值计算相对于newsize的位置*/
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it 把旧的冲突节点放在新的冲突链表上*/
-      newhash[h1] = p;
+      int h1 = lmod(h, tb->size);  /* new position 根据hash值计算相对于newsize的位置*/
+      lua_assert(cast_int(h%tb->size) == lmod(h, tb->size));
+      p->gch.next = tb->hash[h1];  /* chain it 把旧的冲突节点放在新的冲突链表上*/
+      tb->hash[h1] = p;
       p = next;
     }
   }
+  if (tb->rehashpos >= tb->oldsize) {  /* all buckets moved? */
 	//释放旧的hash表
-  luaM_freearray(L, tb->hash, tb->size, TString *);
-  tb->size = newsize;
-  tb->hash = newhash;
+    luaM_freearray(L, tb->oldhash, tb->oldsize, TString *);
+    tb->oldhash = NULL;
+    tb->oldsize = 0;
+    tb->rehashpos = 0;
+  }
+}
+
+
+/*
+** String hash: XXH32 (by Yann Collet). It reads the whole string a word
+** at a time (four independent lanes for strings of 16 bytes or more, so
+** that consecutive words do not wait on each other) and mixes in a seed
+** that is chosen at random for each state, so that colliding keys cannot
+** be precomputed.
+*/
+
+#define PRIME1	0x9E3779B1U
+#define PRIME2	0x85EBCA77U
+#define PRIME3	0xC2B2AE3DU
+#define PRIME4	0x27D4EB2FU
+#define PRIME5	0x165667B1U
+
+#define rotl32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define hround(acc,w)	(acc += (w) * PRIME2, acc = rotl32(acc, 13) * PRIME1)
+
+
+static lu_int32 getword (const char *p) {
+  lu_int32 w;
+  memcpy(&w, p, 4);  /* unaligned load in native byte order */
+  return w;
+}
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  const char *p = str;
+  const char *e = str + l;
+  lu_int32 h;
+  if (l >= 16) {
+    const char *lim = e - 16;
+    lu_int32 v1 = seed + PRIME1 + PRIME2;
+    lu_int32 v2 = seed + PRIME2;
+    lu_int32 v3 = seed;
+    lu_int32 v4 = seed - PRIME1;
+    do {
+      hround(v1, getword(p));
+      hround(v2, getword(p + 4));
+      hround(v3, getword(p + 8));
+      hround(v4, getword(p + 12));
+      p += 16;
+    } while (p <= lim);
+    h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+  }
+  else
+    h = seed + PRIME5;
+  h += cast(lu_int32, l);
+  for (; p + 4 <= e; p += 4) {
+    h += getword(p) * PRIME3;
+    h = rotl32(h, 17) * PRIME4;
+  }
+  for (; p < e; p++) {
+    h += cast(unsigned char, *p) * PRIME5;
+    h = rotl32(h, 11) * PRIME1;
+  }
+  h ^= h >> 15;  /* final avalanche */
+  h *= PRIME2;
+  h ^= h >> 13;
+  h *= PRIME3;
+  h ^= h >> 16;
+  return cast(unsigned int, h);
 }
 
+
 /*
+** creates a new string object (not yet linked anywhere); a NULL `str'
+** leaves the contents for the caller to fill
  创建新字符串
 */
-static TString *newlstr (lua_State *L, const char *str, size_t l,
-                                       unsigned int h) {
+static TString *createstrobj (lua_State *L, const char *str, size_t l,
+                              unsigned int h) {
   TString *ts;
-  stringtable *tb;
 	//字符长度是否越界
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
@@ -70,9 +171,18 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   ts->tsv.marked = luaC_white(G(L));
   ts->tsv.tt = LUA_TSTRING;
   ts->tsv.reserved = 0;
-	memcpy(ts+1, str, l*sizeof(char));	/* 复制字符串到TString内存块地址后面的位置上。*/
+  ts->tsv.extra = 0;
+  if (str != NULL)
+	  memcpy(ts+1, str, l*sizeof(char));	/* 复制字符串到TString内存块地址后面的位置上。*/
   ((char *)(ts+1))[l] = '\0';  /* ending 0 */
-  tb = &G(L)->strt;
+  return ts;
+}
+
+
+static TString *newshrstr (lua_State *L, const char *str, size_t l,
+                                         unsigned int h) {
+  TString *ts = createstrobj(L, str, l, h);
+  stringtable *tb = &G(L)->strt;
   h = lmod(h, tb->size);	/*通过hash值，转换为具体下标位置*/
   ts->tsv.next = tb->hash[h];  /* chain new entry 新的字符串存到hash表里，并把next指向之前冲突的字符串*/
   tb->hash[h] = obj2gco(ts);
@@ -83,20 +193,14 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   return ts;
 }
 
+
 /*
- 创建字符串，如果在全局stringtable里有则不用创建。
+ 创建短字符串，如果在全局stringtable里有则不用创建。
 */
-TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
-  GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  for (l1=l; l1>=step; l1-=step)  /* compute hash 计算hash值*/
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+static TString *findshrstr (lua_State *L, GCObject *o,
+                            const char *str, size_t l) {
 	//遍历在冲突位置上的TString，查找是否已经存在相同的字符串
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
-       o != NULL;
-       o = o->gch.next) {
+  for (; o != NULL; o = o->gch.next) {
 		//转化为TString类型
     TString *ts = rawgco2ts(o);
 		//判断长度和字符串是否相同
@@ -106,8 +210,111 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
+  return NULL;
+}
+
+
+static TString *internshrstr (lua_State *L, const char *str, size_t l) {
+  stringtable *tb = &G(L)->strt;
+  unsigned int h = luaS_hash(str, l, G(L)->seed);
+  TString *ts;
+  if (tb->oldhash != NULL)  /* resize in progress? */
+    luaS_rehashstep(L, REHASHSTEP);
+  if (tb->oldhash != NULL) {  /* (still) in progress? */
+    int h1 = lmod(h, tb->oldsize);
+    if (h1 >= tb->rehashpos &&  /* bucket not moved yet? */
+        (ts = findshrstr(L, tb->oldhash[h1], str, l)) != NULL)
+      return ts;
+  }
+  ts = findshrstr(L, tb->hash[lmod(h, tb->size)], str, l);
+  if (ts != NULL)
+    return ts;
 	//全局string表没有找到，创建新的字符串。
-  return newlstr(L, str, l, h);  /* not found */
+  return newshrstr(L, str, l, h);  /* not found */
+}
+
+
+/*
+** new string (with explicit length); long strings skip the string table:
+** they are neither hashed nor compared against existing strings here
+*/
+TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
+  if (l <= LUAI_MAXSHORTLEN)  /* short string? */
+    return internshrstr(L, str, l);
+  else {
+    TString *ts = luaS_createlngstrobj(L, l);
+    memcpy(ts+1, str, l*sizeof(char));
+    return ts;
+  }
+}
+
+
+/*
+** new long string with its contents left for the caller to fill (they
+** are hashed only on demand, so they may be written after this)
+*/
+TString *luaS_createlngstrobj (lua_State *L, size_t l) {
+  TString *ts;
+  lua_assert(l > LUAI_MAXSHORTLEN);
+  ts = createstrobj(L, NULL, l, G(L)->seed);  /* seed for hash */
+  luaC_link(L, obj2gco(ts), LUA_TSTRING);
+  return ts;
+}
+
+
+/*
+** substring of `ts' with `l' characters from position `i' (0-based).
+** A long suffix of a long string is not copied: it becomes a view into
+** the same contents, which keeps the parent alive. (Only suffixes, as
+** contents must end with a 0.) To bound the memory kept alive by small
+** views, a suffix shorter than a quarter of its parent is copied.
+*/
+TString *luaS_sub (lua_State *L, TString *ts, size_t i, size_t l) {
+  lua_assert(i + l <= ts->tsv.len);
+  if (i == 0 && l == ts->tsv.len)  /* whole string? */
+    return ts;
+  else if (i + l == ts->tsv.len && l > LUAI_MAXSHORTLEN) {  /* long suffix? */
+    TString *parent = isview(ts) ? strview(ts)->parent : ts;
+    if (l >= parent->tsv.len / 4) {
+      TString *v = cast(TString *,
+                        luaM_malloc(L, sizeof(TString) + sizeof(StrView)));
+      v->tsv.len = l;
+      v->tsv.hash = G(L)->seed;  /* seed for hash */
+      v->tsv.tt = LUA_TSTRING;
+      v->tsv.reserved = 0;
+      v->tsv.extra = STRVIEW;
+      strview(v)->parent = parent;
+      strview(v)->s = getstr(ts) + i;
+      luaC_link(L, obj2gco(v), LUA_TSTRING);
+      return v;
+    }
+  }
+  return luaS_newlstr(L, getstr(ts) + i, l);
+}
+
+
+/*
+** hash of a long string, computed at its first use as a table key (until
+** then, `hash' holds the seed)
+*/
+unsigned int luaS_hashlongstr (TString *ts) {
+  lua_assert(!isshortstr(ts));
+  if (!(ts->tsv.extra & STRHASHED)) {  /* no hash yet? */
+    ts->tsv.hash = luaS_hash(getstr(ts), ts->tsv.len, ts->tsv.hash);
+    ts->tsv.extra |= STRHASHED;
+  }
+  return ts->tsv.hash;
+}
+
+
+/*
+** equality for long strings
+*/
+int luaS_eqlngstr (TString *a, TString *b) {
+  size_t len = a->tsv.len;
+  return (a == b) ||  /* same instance or... */
+    ((len == b->tsv.len) &&  /* equal length and ... */
+     (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
 }
 
 
@@ -118,6 +325,7 @@ Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   u = cast(Udata *, luaM_malloc(L, s + sizeof(Udata)));
   u->uv.marked = luaC_white(G(L));  /* is not finalized */
   u->uv.tt = LUA_TUSERDATA;
+  u->uv.atype = LUA_TANONE;
   u->uv.len = s;
   u->uv.metatable = NULL;
   u->uv.env = e;
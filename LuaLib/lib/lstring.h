@@ -13,7 +13,8 @@
 #include "lstate.h"
 
 
-#define sizestring(s)	(sizeof(union TString)+((s)->len+1)*sizeof(char))
+#define sizestring(s)	(sizeof(union TString) + (((s)->extra & STRVIEW) ? \
+			sizeof(StrView) : ((s)->len+1)*sizeof(char)))
 
 #define sizeudata(u)	(sizeof(union Udata)+(u)->len)
 
@@ -23,9 +24,28 @@
 
 #define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
 
+
+/*
+** only strings up to LUAI_MAXSHORTLEN are internalized; longer ones are
+** created anew each time, hashed on demand and compared by contents
+*/
+#define isshortstr(ts)	((ts)->tsv.len <= LUAI_MAXSHORTLEN)
+
+#define luaS_strhash(ts) \
+	(isshortstr(ts) ? (ts)->tsv.hash : luaS_hashlongstr(ts))
+
+#define luaS_eqstr(a,b)	((a) == (b) || (!isshortstr(a) && luaS_eqlngstr(a, b)))
+
+
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_rehashstep (lua_State *L, int n);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_sub (lua_State *L, TString *ts, size_t i, size_t l);
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
+LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
+LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 
 
 #endif
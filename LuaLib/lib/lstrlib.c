@@ -6,6 +6,8 @@
 
 
 #include <ctype.h>
+#include <limits.h>
+#include <locale.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,13 +44,14 @@ static ptrdiff_t posrelat (ptrdiff_t pos, size_t len) {
 
 static int str_sub (lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
-  ptrdiff_t start = posrelat(luaL_checkinteger(L, 2), l);
-  ptrdiff_t end = posrelat(luaL_optinteger(L, 3, -1), l);
+  ptrdiff_t start, end;
+  luaL_checklstring(L, 1, &l);  /* (also converts a number in place) */
+  start = posrelat(luaL_checkinteger(L, 2), l);
+  end = posrelat(luaL_optinteger(L, 3, -1), l);
   if (start < 1) start = 1;
   if (end > (ptrdiff_t)l) end = (ptrdiff_t)l;
-  if (start <= end)
-    lua_pushlstring(L, s+start-1, end-start+1);
+  if (start <= end)  /* long suffixes share the contents of `s' */
+    lua_pushsubstring(L, 1, start-1, end-start+1);
   else lua_pushliteral(L, "");
   return 1;
 }
@@ -146,10 +149,11 @@ static int writer (lua_State *L, const void* b, size_t size, void* B) {
 
 static int str_dump (lua_State *L) {
   luaL_Buffer b;
+  int image = lua_toboolean(L, 2);
   luaL_checktype(L, 1, LUA_TFUNCTION);
   lua_settop(L, 1);
   luaL_buffinit(L,&b);
-  if (lua_dump(L, writer, &b) != 0)
+  if ((image ? lua_dumpimage(L, writer, &b) : lua_dump(L, writer, &b)) != 0)
     luaL_error(L, "unable to dump given function");
   luaL_pushresult(&b);
   return 1;
@@ -167,9 +171,39 @@ static int str_dump (lua_State *L) {
 #define CAP_UNFINISHED	(-1)
 #define CAP_POSITION	(-2)
 
+/*
+** A compiled pattern records, for each position where a single-char
+** class starts, where that class ends and a bitmap of the characters it
+** matches, so that matching neither rescans `[...]' sets nor calls the
+** ctype functions. Compilation stops at the first malformed item; from
+** there on the pattern is interpreted as before (and raises the same
+** errors, if matching ever gets there).
+*/
+
+#define SETSIZE		(UCHAR_MAX/CHAR_BIT + 1)
+
+#define setcharbit(st,c)	((st)[(c) >> 3] |= (1 << ((c) & 7)))
+#define testcharbit(st,c)	((st)[(c) >> 3] & (1 << ((c) & 7)))
+
+typedef struct PItem {
+  int end;  /* offset of the end of the class starting here */
+  int set;  /* index of its bitmap in `sets', or -1 if not compiled */
+} PItem;
+
+typedef struct CPattern {
+  unsigned char (*sets)[SETSIZE];  /* bitmaps (in this same block) */
+  const char *prefix;  /* literal prefix (in this same block) */
+  size_t nprefix;  /* length of `prefix' */
+  int lctype;  /* some bitmap depends on the locale (LC_CTYPE)? */
+  PItem item[1];  /* one for each position in the pattern */
+} CPattern;
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end (`\0') of source string */
+  const char *p_init;  /* init of pattern */
+  const CPattern *cp;  /* compiled pattern */
   lua_State *L;
   int level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -275,6 +309,26 @@ static int singlematch (int c, const char *p, const char *ep) {
 }
 
 
+/* bitmap of the class at `p', or NULL if it was not compiled */
+static const unsigned char *classset (MatchState *ms, const char *p) {
+  const PItem *it = &ms->cp->item[p - ms->p_init];
+  return (it->set >= 0) ? ms->cp->sets[it->set] : NULL;
+}
+
+
+static const char *itemend (MatchState *ms, const char *p) {
+  const PItem *it = &ms->cp->item[p - ms->p_init];
+  return (it->set >= 0) ? p + it->end : classend(ms, p);
+}
+
+
+static int classmatch (MatchState *ms, int c, const char *p,
+                                              const char *ep) {
+  const unsigned char *st = classset(ms, p);
+  return (st != NULL) ? testcharbit(st, c) : singlematch(c, p, ep);
+}
+
+
 static const char *match (MatchState *ms, const char *s, const char *p);
 
 
@@ -301,8 +355,15 @@ static const char *matchbalance (MatchState *ms, const char *s,
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
-  while ((s+i)<ms->src_end && singlematch(uchar(*(s+i)), p, ep))
-    i++;
+  const unsigned char *st = classset(ms, p);
+  if (st != NULL) {
+    while ((s+i)<ms->src_end && testcharbit(st, uchar(*(s+i))))
+      i++;
+  }
+  else {
+    while ((s+i)<ms->src_end && singlematch(uchar(*(s+i)), p, ep))
+      i++;
+  }
   /* keeps trying to match with the maximum repetitions */
   while (i>=0) {
     const char *res = match(ms, (s+i), ep+1);
@@ -319,7 +380,7 @@ static const char *min_expand (MatchState *ms, const char *s,
     const char *res = match(ms, s, ep+1);
     if (res != NULL)
       return res;
-    else if (s<ms->src_end && singlematch(uchar(*s), p, ep))
+    else if (s<ms->src_end && classmatch(ms, uchar(*s), p, ep))
       s++;  /* try with one more repetition */
     else return NULL;
   }
@@ -387,10 +448,10 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
           if (*p != '[')
             luaL_error(ms->L, "missing " LUA_QL("[") " after "
                                LUA_QL("%%f") " in pattern");
-          ep = classend(ms, p);  /* points to what is next */
+          ep = itemend(ms, p);  /* points to what is next */
           previous = (s == ms->src_init) ? '\0' : *(s-1);
-          if (matchbracketclass(uchar(previous), p, ep-1) ||
-             !matchbracketclass(uchar(*s), p, ep-1)) return NULL;
+          if (classmatch(ms, uchar(previous), p, ep) ||
+             !classmatch(ms, uchar(*s), p, ep)) return NULL;
           p=ep; goto init;  /* else return match(ms, s, ep); */
         }
         default: {
@@ -412,8 +473,8 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
       else goto dflt;
     }
     default: dflt: {  /* it is a pattern item */
-      const char *ep = classend(ms, p);  /* points to what is next */
-      int m = s<ms->src_end && singlematch(uchar(*s), p, ep);
+      const char *ep = itemend(ms, p);  /* points to what is next */
+      int m = s<ms->src_end && classmatch(ms, uchar(*s), p, ep);
       switch (*ep) {
         case '?': {  /* optional */
           const char *res;
@@ -441,22 +502,329 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** end of the class starting at `p' (as `classend'), or NULL if it is
+** malformed
+*/
+static const char *compclassend (const char *p) {
+  switch (*p++) {
+    case L_ESC: {
+      return (*p == '\0') ? NULL : p+1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a `]' */
+        if (*p == '\0') return NULL;
+        if (*(p++) == L_ESC && *p != '\0')
+          p++;  /* skip escapes (e.g. `%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+#define classloop(st,f) \
+  { int c; for (c = 0; c <= UCHAR_MAX; c++) if (f(c)) setcharbit(st, c); }
+
+/*
+** adds to `st' the characters of class `%cl' (see `match_class');
+** returns 1 if they depend on the locale
+*/
+static int addclassset (unsigned char *st, int cl) {
+  unsigned char cs[SETSIZE];
+  int i;
+  memset(cs, 0, SETSIZE);
+  switch (tolower(cl)) {
+    case 'a' : classloop(cs, isalpha); break;
+    case 'c' : classloop(cs, iscntrl); break;
+    case 'd' : classloop(cs, isdigit); break;
+    case 'l' : classloop(cs, islower); break;
+    case 'p' : classloop(cs, ispunct); break;
+    case 's' : classloop(cs, isspace); break;
+    case 'u' : classloop(cs, isupper); break;
+    case 'w' : classloop(cs, isalnum); break;
+    case 'x' : classloop(cs, isxdigit); break;
+    case 'z' : setcharbit(cs, 0); break;
+    default: setcharbit(st, cl); return 0;  /* a plain character */
+  }
+  for (i = 0; i < SETSIZE; i++)
+    st[i] |= islower(cl) ? cs[i] : (unsigned char)~cs[i];
+  return (tolower(cl) != 'z');
+}
+
+
+/*
+** fills `st' with the characters matched by the class in [p, ep);
+** returns 1 if they depend on the locale
+*/
+static int buildset (unsigned char *st, const char *p, const char *ep) {
+  int lctype = 0;
+  memset(st, 0, SETSIZE);
+  switch (*p) {
+    case '.': {  /* matches any char */
+      memset(st, 0xFF, SETSIZE);
+      break;
+    }
+    case L_ESC: {
+      lctype = addclassset(st, uchar(*(p+1)));
+      break;
+    }
+    case '[': {
+      const char *ec = ep - 1;  /* the closing `]' */
+      int sig = 1;
+      int i;
+      if (*(p+1) == '^') {
+        sig = 0;
+        p++;  /* skip the `^' */
+      }
+      while (++p < ec) {  /* same scan as `matchbracketclass' */
+        if (*p == L_ESC) {
+          p++;
+          lctype |= addclassset(st, uchar(*p));
+        }
+        else if ((*(p+1) == '-') && (p+2 < ec)) {
+          int c;
+          p+=2;
+          for (c = uchar(*(p-2)); c <= uchar(*p); c++)
+            setcharbit(st, c);
+        }
+        else setcharbit(st, uchar(*p));
+      }
+      if (!sig)  /* complement set */
+        for (i = 0; i < SETSIZE; i++) st[i] = (unsigned char)~st[i];
+      break;
+    }
+    default: {
+      setcharbit(st, uchar(*p));
+      break;
+    }
+  }
+  return lctype;
+}
+
+
+/*
+** walks the pattern items as `match' would see them; when `cp' is not
+** NULL, records each single-char class in it. Returns the number of
+** classes.
+*/
+static int compitems (const char *p0, CPattern *cp) {
+  const char *p = p0;
+  int n = 0;
+  for (;;) {
+    const char *ep;
+    switch (*p) {
+      case '\0': return n;
+      case '(': p += (*(p+1) == ')') ? 2 : 1; continue;
+      case ')': p++; continue;
+      case '$': {
+        if (*(p+1) == '\0') return n;
+        break;  /* else it is a plain character */
+      }
+      case L_ESC: {
+        if (*(p+1) == 'b') {
+          if (*(p+2) == '\0' || *(p+3) == '\0') return n;
+          p += 4; continue;
+        }
+        else if (*(p+1) == 'f') {
+          p += 2;
+          if (*p != '[') return n;
+          break;  /* the set is compiled as a class */
+        }
+        else if (isdigit(uchar(*(p+1)))) {
+          p += 2; continue;
+        }
+        break;
+      }
+    }
+    ep = compclassend(p);
+    if (ep == NULL) return n;  /* malformed; stop here */
+    if (cp != NULL) {
+      PItem *it = &cp->item[p - p0];
+      it->end = (int)(ep - p);
+      it->set = n;
+      cp->lctype |= buildset(cp->sets[n], p, ep);
+    }
+    n++;
+    if (*ep != '\0' && strchr("?*+-", *ep) != NULL)
+      ep++;  /* skip quantifier */
+    p = ep;
+  }
+}
+
+
+/*
+** length of the literal prefix of pattern `p' (characters that any
+** match must start with); copies it to `buff' if it is not NULL
+*/
+static size_t compprefix (const char *p, char *buff) {
+  size_t n = 0;
+  for (;;) {
+    int c;
+    const char *ep;
+    if (*p == L_ESC && *(p+1) != '\0' && !isalnum(uchar(*(p+1)))) {
+      c = *(p+1);  /* escaped punctuation is a plain character */
+      ep = p+2;
+    }
+    else if (*p != '\0' && *p != ')' && strchr(SPECIALS, *p) == NULL) {
+      c = *p;
+      ep = p+1;
+    }
+    else break;
+    if (*ep == '?' || *ep == '*' || *ep == '-')
+      break;  /* optional character */
+    if (buff != NULL) buff[n] = (char)c;
+    n++;
+    if (*ep == '+') break;  /* what follows is not literal */
+    p = ep;
+  }
+  return n;
+}
+
+
+static void compile (lua_State *L, const char *p, size_t l) {
+  int nsets = compitems(p, NULL);
+  size_t nprefix = compprefix(p, NULL);
+  size_t isize = sizeof(CPattern) + l * sizeof(PItem);
+  CPattern *cp = (CPattern *)lua_newuserdata(L,
+                     isize + nsets * SETSIZE + nprefix);
+  size_t i;
+  cp->sets = (unsigned char (*)[SETSIZE])((char *)cp + isize);
+  cp->prefix = (char *)cp->sets + nsets * SETSIZE;
+  cp->nprefix = compprefix(p, (char *)cp->prefix);
+  cp->lctype = 0;
+  for (i = 0; i <= l; i++)
+    cp->item[i].set = -1;
+  compitems(p, cp);
+}
+
+
+/*
+** Compiled patterns (and formats) are cached in the environment of the
+** library functions, which holds one table with weak values keyed by the
+** source string for each kind; so a pattern is compiled once for all its
+** uses between two collections.
+** The compiled pattern is left on the stack (to keep it alive).
+*/
+#define PATTCACHE	1
+#define FMTCACHE	2
+#define PATTLOCALE	3  /* locale of the patterns in the cache */
+
+
+/*
+** Bitmaps of classes like `%a' are built with the locale at compile
+** time, so when the locale changes (by `os.setlocale' or from C) the
+** pattern cache is replaced by an empty one. Returns 1 if it changed.
+*/
+static int checklocale (lua_State *L) {
+  const char *loc = setlocale(LC_CTYPE, NULL);
+  const char *old;
+  int changed;
+  if (loc == NULL) loc = "";
+  lua_rawgeti(L, LUA_ENVIRONINDEX, PATTLOCALE);
+  old = lua_tostring(L, -1);
+  changed = (old == NULL || strcmp(old, loc) != 0);
+  lua_pop(L, 1);
+  if (changed) {
+    lua_pushstring(L, loc);
+    lua_rawseti(L, LUA_ENVIRONINDEX, PATTLOCALE);
+    lua_newtable(L);  /* new cache... */
+    lua_rawgeti(L, LUA_ENVIRONINDEX, PATTCACHE);
+    lua_getmetatable(L, -1);  /* ...with the same (weak) metatable */
+    lua_setmetatable(L, -3);
+    lua_pop(L, 1);
+    lua_rawseti(L, LUA_ENVIRONINDEX, PATTCACHE);
+  }
+  return changed;
+}
+
+
+static const CPattern *getpattern (lua_State *L, int arg) {
+  const CPattern *cp;
+  lua_rawgeti(L, LUA_ENVIRONINDEX, PATTCACHE);
+  lua_pushvalue(L, arg);
+  lua_rawget(L, -2);
+  cp = (const CPattern *)lua_touserdata(L, -1);
+  if (cp == NULL || (cp->lctype && checklocale(L))) {  /* must compile? */
+    size_t l;
+    const char *p = lua_tolstring(L, arg, &l);
+    lua_pop(L, 2);
+    compile(L, p, l);
+    cp = (const CPattern *)lua_touserdata(L, -1);
+    if (cp->lctype)
+      checklocale(L);  /* cache holds patterns for this locale only */
+    lua_rawgeti(L, LUA_ENVIRONINDEX, PATTCACHE);
+    lua_pushvalue(L, arg);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);  /* remove cache table */
+  }
+  else
+    lua_replace(L, -2);  /* remove cache table */
+  return cp;
+}
+
+
+/*
+** Substring search. Candidate positions are filtered by both the first
+** and the last character of `s2' before the rest is compared, so that a
+** common first character does not cost a `memcmp' at each occurrence.
+** With LUA_USE_SSE2, 16 candidates are filtered at a time.
+*/
+
+#if defined(LUA_USE_SSE2)
+
+#include <emmintrin.h>
+
+/*
+** tries all candidates in [s1, last] that fit in whole blocks of 16;
+** returns the match, or NULL with `*next' at the first candidate left
+*/
+static const char *ssefind (const char *s1, const char *last,
+                            const char *s2, size_t l2, const char **next) {
+  const __m128i vf = _mm_set1_epi8(s2[0]);
+  const __m128i vl = _mm_set1_epi8(s2[l2 - 1]);
+  for (; last - s1 >= 15; s1 += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)s1);
+    __m128i bl = _mm_loadu_si128((const __m128i *)(s1 + l2 - 1));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(vf, bf), _mm_cmpeq_epi8(vl, bl)));
+    while (mask != 0) {  /* for each candidate */
+      int i = __builtin_ctz(mask);
+      if (memcmp(s1 + i + 1, s2 + 1, l2 - 2) == 0)
+        return s1 + i;
+      mask &= mask - 1;  /* clear lowest bit */
+    }
+  }
+  *next = s1;
+  return NULL;
+}
+
+#endif
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative `l1' */
+  else if (l2 == 1) return (const char *)memchr(s1, *s2, l1);
   else {
-    const char *init;  /* to search for a `*s2' inside `s1' */
-    l2--;  /* 1st char will be checked by `memchr' */
-    l1 = l1-l2;  /* `s2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct `l1' and `s1' to try again */
-        l1 -= init-s1;
-        s1 = init;
-      }
+    const char *last = s1 + (l1 - l2);  /* last possible start */
+    const char *init = s1;  /* to search for a `*s2' inside `s1' */
+#if defined(LUA_USE_SSE2)
+    const char *res = ssefind(s1, last, s2, l2, &init);
+    if (res != NULL) return res;
+#endif
+    while (init <= last &&
+           (init = (const char *)memchr(init, *s2, last - init + 1)) != NULL) {
+      if (init[l2 - 1] == s2[l2 - 1] &&  /* last char also matches? */
+          memcmp(init + 1, s2 + 1, l2 - 2) == 0)
+        return init;
+      init++;  /* try again after this candidate */
     }
     return NULL;  /* not found */
   }
@@ -511,13 +879,21 @@ static int str_find_aux (lua_State *L, int find) {
   }
   else {
     MatchState ms;
-    int anchor = (*p == '^') ? (p++, 1) : 0;
+    const CPattern *cp = getpattern(L, 2);
+    int anchor;
     const char *s1=s+init;
     ms.L = L;
     ms.src_init = s;
     ms.src_end = s+l1;
+    ms.p_init = p;
+    ms.cp = cp;
+    anchor = (*p == '^') ? (p++, 1) : 0;
     do {
       const char *res;
+      if (!anchor && cp->nprefix > 0) {  /* skip to next candidate */
+        s1 = lmemfind(s1, ms.src_end - s1, cp->prefix, cp->nprefix);
+        if (s1 == NULL) break;
+      }
       ms.level = 0;
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -550,14 +926,22 @@ static int gmatch_aux (lua_State *L) {
   size_t ls;
   const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
   const char *p = lua_tostring(L, lua_upvalueindex(2));
+  const CPattern *cp = (const CPattern *)lua_touserdata(L,
+                                             lua_upvalueindex(4));
   const char *src;
   ms.L = L;
   ms.src_init = s;
   ms.src_end = s+ls;
+  ms.p_init = p;
+  ms.cp = cp;
   for (src = s + (size_t)lua_tointeger(L, lua_upvalueindex(3));
        src <= ms.src_end;
        src++) {
     const char *e;
+    if (cp->nprefix > 0) {  /* skip to next candidate */
+      src = lmemfind(src, ms.src_end - src, cp->prefix, cp->nprefix);
+      if (src == NULL) break;
+    }
     ms.level = 0;
     if ((e = match(&ms, src, p)) != NULL) {
       lua_Integer newstart = e-s;
@@ -576,7 +960,8 @@ static int gmatch (lua_State *L) {
   luaL_checkstring(L, 2);
   lua_settop(L, 2);
   lua_pushinteger(L, 0);
-  lua_pushcclosure(L, gmatch_aux, 3);
+  getpattern(L, 2);
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -647,19 +1032,31 @@ static int str_gsub (lua_State *L) {
   const char *p = luaL_checkstring(L, 2);
   int  tr = lua_type(L, 3);
   int max_s = luaL_optint(L, 4, srcl+1);
-  int anchor = (*p == '^') ? (p++, 1) : 0;
+  int anchor;
   int n = 0;
+  const CPattern *cp;
   MatchState ms;
   luaL_Buffer b;
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
+  cp = getpattern(L, 2);
   luaL_buffinit(L, &b);
   ms.L = L;
   ms.src_init = src;
   ms.src_end = src+srcl;
+  ms.p_init = p;
+  ms.cp = cp;
+  anchor = (*p == '^') ? (p++, 1) : 0;
   while (n < max_s) {
     const char *e;
+    if (!anchor && cp->nprefix > 0) {  /* skip to next candidate */
+      const char *next = lmemfind(src, ms.src_end - src,
+                                  cp->prefix, cp->nprefix);
+      if (next == NULL) break;  /* no more matches */
+      luaL_addlstring(&b, src, next - src);  /* keep skipped text */
+      src = next;
+    }
     ms.level = 0;
     e = match(&ms, src, p);
     if (e) {
@@ -679,6 +1076,94 @@ static int str_gsub (lua_State *L) {
   return 2;
 }
 
+/*
+** string.split(s, sep [, plain [, max]]): returns a table with the pieces
+** of `s' separated by `sep', a pattern unless `plain' is true (or it has
+** no special characters). Empty matches do not split. With `max', there
+** are at most `max' pieces, the last one holding the rest of `s'.
+*/
+static int str_split (lua_State *L) {
+  size_t ls, lsep;
+  const char *s0 = luaL_checklstring(L, 1, &ls);
+  const char *sep = luaL_checklstring(L, 2, &lsep);
+  lua_Integer max = luaL_optinteger(L, 4, INT_MAX);
+  const char *e = s0 + ls;
+  const char *s = s0;  /* start of current piece */
+  int n = 0;  /* number of pieces so far */
+  luaL_argcheck(L, lsep > 0, 2, "empty separator");
+  luaL_argcheck(L, max > 0, 4, "must be positive");
+  if (lua_toboolean(L, 3) || strpbrk(sep, SPECIALS) == NULL) {
+    const char *p = s;
+    int size = 1;
+    while (size < max && (p = lmemfind(p, e - p, sep, lsep)) != NULL) {
+      size++;  /* count pieces to presize the table */
+      p += lsep;
+    }
+    lua_createtable(L, size, 0);
+    for (; n + 1 < size; s = p + lsep) {
+      p = lmemfind(s, e - s, sep, lsep);
+      lua_pushlstring(L, s, p - s);
+      lua_rawseti(L, -2, ++n);
+    }
+  }
+  else {
+    MatchState ms;
+    const CPattern *cp = getpattern(L, 2);
+    const char *src = s;
+    ms.L = L;
+    ms.src_init = s0;
+    ms.src_end = e;
+    ms.p_init = sep;
+    ms.cp = cp;
+    lua_newtable(L);
+    while (n + 1 < max) {
+      const char *m = NULL;
+      for (; src < e; src++) {  /* look for next non-empty match */
+        if (cp->nprefix > 0) {  /* skip to next candidate */
+          src = lmemfind(src, e - src, cp->prefix, cp->nprefix);
+          if (src == NULL) break;
+        }
+        ms.level = 0;
+        if ((m = match(&ms, src, sep)) != NULL && m > src) break;
+      }
+      if (src == NULL || src >= e) break;  /* no more separators */
+      lua_pushlstring(L, s, src - s);
+      lua_rawseti(L, -2, ++n);
+      s = src = m;
+    }
+  }
+  lua_pushsubstring(L, 1, s - s0, e - s);  /* last piece is a suffix */
+  lua_rawseti(L, -2, ++n);
+  return 1;
+}
+
+
+static int lines_aux (lua_State *L) {
+  size_t ls;
+  const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
+  size_t pos = (size_t)lua_tointeger(L, lua_upvalueindex(2));
+  const char *p = s + pos;
+  const char *nl;
+  if (pos >= ls) return 0;  /* no more lines */
+  nl = (const char *)memchr(p, '\n', ls - pos);
+  if (nl == NULL) nl = s + ls;  /* last line has no newline */
+  lua_pushinteger(L, nl - s + 1);
+  lua_replace(L, lua_upvalueindex(2));
+  lua_pushsubstring(L, lua_upvalueindex(1), pos, nl - p);
+  return 1;
+}
+
+
+/* string.lines(s): iterates over the lines of `s', without newlines */
+static int str_lines (lua_State *L) {
+  luaL_checkstring(L, 1);
+  lua_settop(L, 1);
+  lua_pushinteger(L, 0);
+  lua_pushcclosure(L, lines_aux, 2);
+  return 1;
+}
+
+
 /* }====================================================== */
 
 
@@ -696,14 +1181,16 @@ static int str_gsub (lua_State *L) {
 static void addquoted (lua_State *L, luaL_Buffer *b, int arg) {
   size_t l;
   const char *s = luaL_checklstring(L, arg, &l);
+  const char *e = s + l;
   luaL_addchar(b, '"');
-  while (l--) {
-    switch (*s) {
-      case '"': case '\\': case '\n': {
-        luaL_addchar(b, '\\');
-        luaL_addchar(b, *s);
-        break;
-      }
+  for (;;) {
+    const char *q = s;
+    while (q < e && *q != '"' && *q != '\\' && *q != '\n' &&
+                    *q != '\r' && *q != '\0')
+      q++;  /* skip characters that need no escape */
+    luaL_addlstring(b, s, q - s);
+    if (q == e) break;
+    switch (*q) {
       case '\r': {
         luaL_addlstring(b, "\\r", 2);
         break;
@@ -712,21 +1199,29 @@ static void addquoted (lua_State *L, luaL_Buffer *b, int arg) {
         luaL_addlstring(b, "\\000", 4);
         break;
       }
-      default: {
-        luaL_addchar(b, *s);
+      default: {  /* '"', '\\', or '\n' */
+        luaL_addchar(b, '\\');
+        luaL_addchar(b, *q);
         break;
       }
     }
-    s++;
+    s = q + 1;
   }
   luaL_addchar(b, '"');
 }
 
-static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
+/*
+** reads the specification after a `%' into `form'; returns the position
+** of the conversion character, or NULL (with an error message in `*msg')
+*/
+static const char *scanformat (const char *strfrmt, char *form,
+                               const char **msg) {
   const char *p = strfrmt;
   while (*p != '\0' && strchr(FLAGS, *p) != NULL) p++;  /* skip flags */
-  if ((size_t)(p - strfrmt) >= sizeof(FLAGS))
-    luaL_error(L, "invalid format (repeated flags)");
+  if ((size_t)(p - strfrmt) >= sizeof(FLAGS)) {
+    *msg = "invalid format (repeated flags)";
+    return NULL;
+  }
   if (isdigit(uchar(*p))) p++;  /* skip width */
   if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
   if (*p == '.') {
@@ -734,8 +1229,10 @@ static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
     if (isdigit(uchar(*p))) p++;  /* skip precision */
     if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
   }
-  if (isdigit(uchar(*p)))
-    luaL_error(L, "invalid format (width or precision too long)");
+  if (isdigit(uchar(*p))) {
+    *msg = "invalid format (width or precision too long)";
+    return NULL;
+  }
   *(form++) = '%';
   strncpy(form, strfrmt, p - strfrmt + 1);
   form += p - strfrmt + 1;
@@ -753,70 +1250,562 @@ static void addintlen (char *form) {
 }
 
 
+/*
+** A format string is parsed once into a list of items, each one a
+** stretch of literal text followed by a conversion; the parsed format
+** is cached like compiled patterns. Items without flags, width, or
+** precision (the common `%d', `%s', ...) are formatted directly,
+** without `sprintf'.
+*/
+
+typedef struct FItem {
+  size_t lit;  /* position of the literal text in the format string */
+  size_t nlit;  /* length of the literal text */
+  char conv;  /* conversion character, or one of the codes below */
+  char plain;  /* true if conversion has no flags, width, or precision */
+  char form[MAX_FORMAT];  /* format for `sprintf' (`%...') */
+} FItem;
+
+#define FNONE	0	/* literal text only (e.g. ending in a `%%') */
+#define FEND	1	/* literal text ends the format */
+#define FBAD	2	/* literal text followed by an invalid conversion */
+
+typedef struct CFormat {
+  FItem item[1];  /* items, up to one with code FEND or FBAD */
+} CFormat;
+
+
+static void compformat (lua_State *L, const char *f, size_t l) {
+  const char *fend = f + l;
+  const char *p = f;
+  size_t n = 1;
+  FItem *it;
+  while ((p = (const char *)memchr(p, L_ESC, fend - p)) != NULL) {
+    n++;  /* each item but the last ends at a `%' */
+    p++;
+  }
+  it = ((CFormat *)lua_newuserdata(L, sizeof(CFormat) +
+                                      (n - 1) * sizeof(FItem)))->item;
+  for (p = f; ; it++) {
+    const char *pc = (const char *)memchr(p, L_ESC, fend - p);
+    it->lit = p - f;
+    if (pc == NULL) {
+      it->nlit = fend - p;
+      it->conv = FEND;
+      return;
+    }
+    it->nlit = pc - p;
+    if (pc[1] == L_ESC) {  /* `%%'? */
+      it->nlit++;  /* keep one `%' in the literal text */
+      it->conv = FNONE;
+      p = pc + 2;
+    }
+    else {
+      const char *msg;
+      p = scanformat(pc + 1, it->form, &msg);
+      if (p == NULL || *p == '\0' || strchr("cdiouxXeEfgGqs", *p) == NULL) {
+        it->conv = FBAD;  /* let `badformat' raise the error */
+        return;
+      }
+      it->conv = *p;
+      it->plain = (p == pc + 1);
+      if (strchr("diouxX", *p) != NULL)
+        addintlen(it->form);
+      p++;
+    }
+  }
+}
+
+
+/* leaves the parsed format on the stack (to keep it alive) */
+static const CFormat *getformat (lua_State *L, int arg) {
+  luaL_checkstring(L, arg);
+  lua_rawgeti(L, LUA_ENVIRONINDEX, FMTCACHE);
+  lua_pushvalue(L, arg);
+  lua_rawget(L, -2);
+  if (lua_isnil(L, -1)) {  /* not parsed yet? */
+    size_t l;
+    const char *f = lua_tolstring(L, arg, &l);
+    lua_pop(L, 1);
+    compformat(L, f, l);
+    lua_pushvalue(L, arg);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+  }
+  lua_replace(L, -2);  /* remove cache table */
+  return (const CFormat *)lua_touserdata(L, -1);
+}
+
+
+/* raises the error for the invalid specification after `%' at `strfrmt' */
+static void badformat (lua_State *L, const char *strfrmt) {
+  char form[MAX_FORMAT];
+  const char *msg;
+  const char *p = scanformat(strfrmt, form, &msg);
+  if (p == NULL)
+    luaL_error(L, "%s", msg);
+  luaL_error(L, "invalid option " LUA_QL("%%%c") " to "
+                LUA_QL("format"), *p);  /* also treat cases `pnLlh' */
+}
+
+
+/* adds the digits of `n' in base `base' (with a sign if `neg') */
+static void addint (luaL_Buffer *b, unsigned LUA_INTFRM_T n, int neg,
+                    unsigned base, const char *digits) {
+  char buff[3 * sizeof(n) + 2];
+  char *p = buff + sizeof(buff);
+  do {
+    *--p = digits[n % base];
+    n /= base;
+  } while (n != 0);
+  if (neg) *--p = '-';
+  luaL_addlstring(b, p, buff + sizeof(buff) - p);
+}
+
+
+static void additem (lua_State *L, luaL_Buffer *b, int arg,
+                     const FItem *it) {
+  char buff[MAX_ITEM];  /* to store the formatted item */
+  switch (it->conv) {
+    case 'c': {
+      sprintf(buff, it->form, (int)luaL_checknumber(L, arg));
+      break;
+    }
+    case 'd':  case 'i': {
+      LUA_INTFRM_T n = (LUA_INTFRM_T)luaL_checknumber(L, arg);
+      if (it->plain) {
+        unsigned LUA_INTFRM_T u = (unsigned LUA_INTFRM_T)n;
+        addint(b, (n < 0) ? 0u - u : u, (n < 0), 10, "0123456789");
+        return;
+      }
+      sprintf(buff, it->form, n);
+      break;
+    }
+    case 'o':  case 'u':  case 'x':  case 'X': {
+      unsigned LUA_INTFRM_T n =
+          (unsigned LUA_INTFRM_T)luaL_checknumber(L, arg);
+      if (it->plain) {
+        switch (it->conv) {
+          case 'o': addint(b, n, 0, 8, "01234567"); break;
+          case 'u': addint(b, n, 0, 10, "0123456789"); break;
+          case 'x': addint(b, n, 0, 16, "0123456789abcdef"); break;
+          default: addint(b, n, 0, 16, "0123456789ABCDEF"); break;
+        }
+        return;
+      }
+      sprintf(buff, it->form, n);
+      break;
+    }
+    case 'e':  case 'E': case 'f':
+    case 'g': case 'G': {
+      sprintf(buff, it->form, (double)luaL_checknumber(L, arg));
+      break;
+    }
+    case 'q': {
+      addquoted(L, b, arg);
+      return;
+    }
+    default: {  /* case 's' */
+      size_t l;
+      const char *s = luaL_checklstring(L, arg, &l);
+      if (!strchr(it->form, '.') && l >= 100) {
+        /* no precision and string is too long to be formatted;
+           keep original string */
+        lua_pushvalue(L, arg);
+        luaL_addvalue(b);
+        return;
+      }
+      else if (it->plain) {  /* what `sprintf' would copy */
+        luaL_addlstring(b, s, strlen(s));
+        return;
+      }
+      else {
+        sprintf(buff, it->form, s);
+        break;
+      }
+    }
+  }
+  luaL_addlstring(b, buff, strlen(buff));
+}
+
+
+/*
+** adds to `b' the result of formatting the arguments from `arg' on,
+** where the one at `arg' is the format string (already parsed into
+** `cf') and `top' is the last argument
+*/
+static void addformat (lua_State *L, luaL_Buffer *b, int arg, int top,
+                       const CFormat *cf) {
+  const char *strfrmt = lua_tostring(L, arg);
+  const FItem *it;
+  for (it = cf->item; ; it++) {
+    luaL_addlstring(b, strfrmt + it->lit, it->nlit);
+    if (it->conv == FNONE) continue;
+    else if (it->conv == FEND) return;
+    if (++arg > top)
+      luaL_argerror(L, arg, "no value");
+    if (it->conv == FBAD)
+      badformat(L, strfrmt + it->lit + it->nlit + 1);
+    additem(L, b, arg, it);
+  }
+}
+
+
 static int str_format (lua_State *L) {
   int top = lua_gettop(L);
-  int arg = 1;
-  size_t sfl;
-  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
-  const char *strfrmt_end = strfrmt+sfl;
+  const CFormat *cf = getformat(L, 1);
   luaL_Buffer b;
   luaL_buffinit(L, &b);
-  while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
-    else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
-    else { /* format item */
-      char form[MAX_FORMAT];  /* to store the format (`%...') */
-      char buff[MAX_ITEM];  /* to store the formatted item */
-      if (++arg > top)
-        luaL_argerror(L, arg, "no value");
-      strfrmt = scanformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          sprintf(buff, form, (int)luaL_checknumber(L, arg));
-          break;
-        }
-        case 'd':  case 'i': {
-          addintlen(form);
-          sprintf(buff, form, (LUA_INTFRM_T)luaL_checknumber(L, arg));
-          break;
-        }
-        case 'o':  case 'u':  case 'x':  case 'X': {
-          addintlen(form);
-          sprintf(buff, form, (unsigned LUA_INTFRM_T)luaL_checknumber(L, arg));
-          break;
-        }
-        case 'e':  case 'E': case 'f':
-        case 'g': case 'G': {
-          sprintf(buff, form, (double)luaL_checknumber(L, arg));
-          break;
-        }
-        case 'q': {
-          addquoted(L, &b, arg);
-          continue;  /* skip the 'addsize' at the end */
-        }
-        case 's': {
-          size_t l;
-          const char *s = luaL_checklstring(L, arg, &l);
-          if (!strchr(form, '.') && l >= 100) {
-            /* no precision and string is too long to be formatted;
-               keep original string */
-            lua_pushvalue(L, arg);
-            luaL_addvalue(&b);
-            continue;  /* skip the `addsize' at the end */
-          }
-          else {
-            sprintf(buff, form, s);
-            break;
-          }
-        }
-        default: {  /* also treat cases `pnLlh' */
-          return luaL_error(L, "invalid option " LUA_QL("%%%c") " to "
-                               LUA_QL("format"), *(strfrmt - 1));
+  addformat(L, &b, 1, top, cf);
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+
+/*
+** {======================================================
+** PACK/UNPACK
+** =======================================================
+*/
+
+
+/* value used for padding */
+#if !defined(LUAL_PACKPADBYTE)
+#define LUAL_PACKPADBYTE		0x00
+#endif
+
+/* maximum size for the binary representation of an integer */
+#define MAXINTSIZE	16
+
+/* number of bits in a character */
+#define NB	CHAR_BIT
+
+/* mask for one character (NB 1's) */
+#define MC	((1 << NB) - 1)
+
+/* maximum size of a packed result */
+#define MAXSIZE  \
+	(sizeof(size_t) < sizeof(int) ? (~(size_t)0) : (size_t)(INT_MAX))
+
+
+/*
+** Numbers are doubles; integers are packed through the widest integer
+** type that `format' uses
+*/
+typedef LUA_INTFRM_T PackInt;
+typedef unsigned LUA_INTFRM_T PackUInt;
+
+/* size of a PackInt */
+#define SZINT	((int)sizeof(PackInt))
+
+/* 2^(SZINT*NB), the limit for the absolute value of a packed integer */
+#define MAXPACKNUM	(2 * (lua_Number)((PackUInt)1 << (SZINT * NB - 1)))
+
+
+/* dummy union to get native endianness */
+static const union {
+  int dummy;
+  char little;  /* true iff machine is little endian */
+} nativeendian = {1};
+
+
+/* dummy structure to get native alignment requirements */
+struct cD {
+  char c;
+  union { double d; void *p; lua_Integer i; lua_Number n; } u;
+};
+
+#define MAXALIGN	(offsetof(struct cD, u))
+
+
+/*
+** Union for serializing floats
+*/
+typedef union Ftypes {
+  float f;
+  double d;
+  lua_Number n;
+  char buff[5 * sizeof(lua_Number)];  /* enough for any float type */
+} Ftypes;
+
+
+/*
+** information to pack/unpack stuff
+*/
+typedef struct Header {
+  lua_State *L;
+  int islittle;
+  int maxalign;
+} Header;
+
+
+/*
+** options for pack/unpack
+*/
+typedef enum KOption {
+  Kint,		/* signed integers */
+  Kuint,	/* unsigned integers */
+  Kfloat,	/* floating-point numbers */
+  Kchar,	/* fixed-length strings */
+  Kstring,	/* strings with prefixed length */
+  Kzstr,	/* zero-terminated strings */
+  Kpadding,	/* padding */
+  Kpaddalign,	/* padding for alignment */
+  Knop		/* no-op (configuration or spaces) */
+} KOption;
+
+
+/*
+** Read an integer numeral from string `fmt' or return `df' if
+** there is no numeral
+*/
+static int getnum (const char **fmt, int df) {
+  if (!isdigit(uchar(**fmt)))  /* no number? */
+    return df;  /* return default value */
+  else {
+    int a = 0;
+    do {
+      a = a*10 + (*((*fmt)++) - '0');
+    } while (isdigit(uchar(**fmt)) && a <= ((int)MAXSIZE - 9)/10);
+    return a;
+  }
+}
+
+
+/*
+** Read an integer numeral and raises an error if it is larger
+** than the maximum size for integers.
+*/
+static int getnumlimit (Header *h, const char **fmt, int df) {
+  int sz = getnum(fmt, df);
+  if (sz > MAXINTSIZE || sz <= 0)
+    luaL_error(h->L, "integral size (%d) out of limits [1,%d]",
+                     sz, MAXINTSIZE);
+  return sz;
+}
+
+
+static void initheader (lua_State *L, Header *h) {
+  h->L = L;
+  h->islittle = nativeendian.little;
+  h->maxalign = 1;
+}
+
+
+/*
+** Read and classify next option. `size' is filled with option's size.
+*/
+static KOption getoption (Header *h, const char **fmt, int *size) {
+  int opt = *((*fmt)++);
+  *size = 0;  /* default */
+  switch (opt) {
+    case 'b': *size = sizeof(char); return Kint;
+    case 'B': *size = sizeof(char); return Kuint;
+    case 'h': *size = sizeof(short); return Kint;
+    case 'H': *size = sizeof(short); return Kuint;
+    case 'l': *size = sizeof(long); return Kint;
+    case 'L': *size = sizeof(long); return Kuint;
+    case 'j': *size = sizeof(lua_Integer); return Kint;
+    case 'J': *size = sizeof(lua_Integer); return Kuint;
+    case 'T': *size = sizeof(size_t); return Kuint;
+    case 'f': *size = sizeof(float); return Kfloat;
+    case 'd': *size = sizeof(double); return Kfloat;
+    case 'n': *size = sizeof(lua_Number); return Kfloat;
+    case 'i': *size = getnumlimit(h, fmt, sizeof(int)); return Kint;
+    case 'I': *size = getnumlimit(h, fmt, sizeof(int)); return Kuint;
+    case 's': *size = getnumlimit(h, fmt, sizeof(size_t)); return Kstring;
+    case 'c': {
+      *size = getnum(fmt, -1);
+      if (*size == -1)
+        luaL_error(h->L, "missing size for format option " LUA_QL("c"));
+      return Kchar;
+    }
+    case 'z': return Kzstr;
+    case 'x': *size = 1; return Kpadding;
+    case 'X': return Kpaddalign;
+    case ' ': break;
+    case '<': h->islittle = 1; break;
+    case '>': h->islittle = 0; break;
+    case '=': h->islittle = nativeendian.little; break;
+    case '!': h->maxalign = getnumlimit(h, fmt, MAXALIGN); break;
+    default: luaL_error(h->L, "invalid format option " LUA_QL("%c"), opt);
+  }
+  return Knop;
+}
+
+
+/*
+** Read, classify, and fill other details about the next option.
+** `psize' is filled with option's size, `notoalign' with its
+** alignment requirements.
+** Local variable `size' gets the size to be aligned. (Kpadal option
+** always gets its full alignment, other options are limited by
+** the maximum alignment (`maxalign'). Kchar option needs no alignment
+** despite its size.
+*/
+static KOption getdetails (Header *h, size_t totalsize,
+                           const char **fmt, int *psize, int *ntoalign) {
+  KOption opt = getoption(h, fmt, psize);
+  int align = *psize;  /* usually, alignment follows size */
+  if (opt == Kpaddalign) {  /* `X' gets alignment from following option */
+    if (**fmt == '\0' || getoption(h, fmt, &align) == Kchar || align == 0)
+      luaL_argerror(h->L, 1, "invalid next option for option " LUA_QL("X"));
+  }
+  if (align <= 1 || opt == Kchar)  /* need no alignment? */
+    *ntoalign = 0;
+  else {
+    if (align > h->maxalign)  /* enforce maximum alignment */
+      align = h->maxalign;
+    if ((align & (align - 1)) != 0)  /* is `align' not a power of 2? */
+      luaL_argerror(h->L, 1, "format asks for alignment not power of 2");
+    *ntoalign = (align - (int)(totalsize & (align - 1))) & (align - 1);
+  }
+  return opt;
+}
+
+
+/*
+** gets argument `arg' as an integer (in two's complement, truncated
+** towards zero), setting `*neg' if it is negative
+*/
+static PackUInt checkpackint (lua_State *L, int arg, int *neg) {
+  lua_Number n = luaL_checknumber(L, arg);
+  lua_Number a = (n < 0) ? -n : n;
+  PackUInt u;
+  luaL_argcheck(L, a < MAXPACKNUM, arg, "integer overflow");
+  u = (PackUInt)a;
+  *neg = (n < 0 && u != 0);
+  return *neg ? 0u - u : u;
+}
+
+
+/*
+** Pack integer `n' with `size' bytes and `islittle' endianness.
+** The final `if' handles the case when `size' is larger than
+** the size of a PackInt, correcting the extra sign-extension
+** bytes if necessary (by default they would be zeros).
+*/
+static void packint (luaL_Buffer *b, PackUInt n,
+                     int islittle, int size, int neg) {
+  char buff[MAXINTSIZE];
+  int i;
+  buff[islittle ? 0 : size - 1] = (char)(n & MC);  /* first byte */
+  for (i = 1; i < size; i++) {
+    n >>= NB;
+    buff[islittle ? i : size - 1 - i] = (char)(n & MC);
+  }
+  if (neg && size > SZINT) {  /* negative number need sign extension? */
+    for (i = SZINT; i < size; i++)  /* correct extra bytes */
+      buff[islittle ? i : size - 1 - i] = (char)MC;
+  }
+  luaL_addlstring(b, buff, size);
+}
+
+
+/*
+** Copy `size' bytes from `src' to `dest', correcting endianness if
+** given `islittle' is different from native endianness.
+*/
+static void copywithendian (volatile char *dest, volatile const char *src,
+                            int size, int islittle) {
+  if (islittle == nativeendian.little) {
+    while (size-- != 0)
+      *(dest++) = *(src++);
+  }
+  else {
+    dest += size - 1;
+    while (size-- != 0)
+      *(dest--) = *(src++);
+  }
+}
+
+
+static int str_pack (lua_State *L) {
+  luaL_Buffer b;
+  Header h;
+  const char *fmt = luaL_checkstring(L, 1);  /* format string */
+  int arg = 1;  /* current argument to pack */
+  size_t totalsize = 0;  /* accumulate total size of result */
+  initheader(L, &h);
+  lua_pushnil(L);  /* mark to separate arguments from string buffer */
+  luaL_buffinit(L, &b);
+  while (*fmt != '\0') {
+    int size, ntoalign, neg;
+    KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
+    totalsize += ntoalign + size;
+    while (ntoalign-- > 0)
+     luaL_addchar(&b, LUAL_PACKPADBYTE);  /* fill alignment */
+    arg++;
+    switch (opt) {
+      case Kint: {  /* signed integers */
+        PackUInt n = checkpackint(L, arg, &neg);
+        if (size <= SZINT) {  /* need overflow check? */
+          PackUInt lim = (PackUInt)1 << ((size * NB) - 1);
+          luaL_argcheck(L, neg ? 0u - n <= lim : n < lim, arg,
+                           "integer overflow");
         }
+        packint(&b, n, h.islittle, size, neg);
+        break;
+      }
+      case Kuint: {  /* unsigned integers */
+        PackUInt n = checkpackint(L, arg, &neg);
+        if (size < SZINT)  /* need overflow check? */
+          luaL_argcheck(L, n < ((PackUInt)1 << (size * NB)),
+                           arg, "unsigned overflow");
+        packint(&b, n, h.islittle, size, 0);
+        break;
+      }
+      case Kfloat: {  /* floating-point options */
+        volatile Ftypes u;
+        char buff[sizeof(Ftypes)];
+        lua_Number n = luaL_checknumber(L, arg);  /* get argument */
+        if (size == sizeof(u.f)) u.f = (float)n;  /* copy it into `u' */
+        else if (size == sizeof(u.d)) u.d = (double)n;
+        else u.n = n;
+        /* move `u' to final result, correcting endianness if needed */
+        copywithendian(buff, u.buff, size, h.islittle);
+        luaL_addlstring(&b, buff, size);
+        break;
+      }
+      case Kchar: {  /* fixed-size string */
+        size_t len;
+        const char *s = luaL_checklstring(L, arg, &len);
+        luaL_argcheck(L, len <= (size_t)size, arg,
+                         "string longer than given size");
+        luaL_addlstring(&b, s, len);  /* add string */
+        while (len++ < (size_t)size)  /* pad extra space */
+          luaL_addchar(&b, LUAL_PACKPADBYTE);
+        break;
       }
-      luaL_addlstring(&b, buff, strlen(buff));
+      case Kstring: {  /* strings with length count */
+        size_t len;
+        const char *s = luaL_checklstring(L, arg, &len);
+        luaL_argcheck(L, size >= (int)sizeof(size_t) ||
+                         len < ((size_t)1 << (size * NB)),
+                         arg, "string length does not fit in given size");
+        packint(&b, (PackUInt)len, h.islittle, size, 0);  /* pack length */
+        luaL_addlstring(&b, s, len);
+        totalsize += len;
+        break;
+      }
+      case Kzstr: {  /* zero-terminated string */
+        size_t len;
+        const char *s = luaL_checklstring(L, arg, &len);
+        luaL_argcheck(L, strlen(s) == len, arg, "string contains zeros");
+        luaL_addlstring(&b, s, len);
+        luaL_addchar(&b, '\0');  /* add zero at the end */
+        totalsize += len + 1;
+        break;
+      }
+      case Kpadding: {
+        luaL_addchar(&b, LUAL_PACKPADBYTE);
+        arg--;  /* undo increment */
+        break;
+      }
+      case Kpaddalign: case Knop:
+        arg--;  /* undo increment */
+        break;
     }
   }
   luaL_pushresult(&b);
@@ -824,21 +1813,303 @@ static int str_format (lua_State *L) {
 }
 
 
+static int str_packsize (lua_State *L) {
+  Header h;
+  const char *fmt = luaL_checkstring(L, 1);  /* format string */
+  size_t totalsize = 0;  /* accumulate total size of result */
+  initheader(L, &h);
+  while (*fmt != '\0') {
+    int size, ntoalign;
+    KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
+    luaL_argcheck(L, opt != Kstring && opt != Kzstr, 1,
+                     "variable-length format");
+    size += ntoalign;  /* total space used by option */
+    luaL_argcheck(L, totalsize <= MAXSIZE - size, 1,
+                     "format result too large");
+    totalsize += size;
+  }
+  lua_pushinteger(L, (lua_Integer)totalsize);
+  return 1;
+}
+
+
+/*
+** Unpack an integer with `size' bytes and `islittle' endianness.
+** If size is smaller than the size of a PackInt and integer
+** is signed, must do sign extension (propagating the sign to the
+** higher bits); if size is larger than the size of a PackInt,
+** it must check the unread bytes to see whether they do not cause an
+** overflow.
+*/
+static PackUInt unpackint (lua_State *L, const char *str,
+                           int islittle, int size, int issigned) {
+  PackUInt res = 0;
+  int i;
+  int limit = (size  <= SZINT) ? size : SZINT;
+  for (i = limit - 1; i >= 0; i--) {
+    res <<= NB;
+    res |= (PackUInt)(unsigned char)str[islittle ? i : size - 1 - i];
+  }
+  if (size < SZINT) {  /* real size smaller than PackInt? */
+    if (issigned) {  /* needs sign extension? */
+      PackUInt mask = (PackUInt)1 << (size*NB - 1);
+      res = ((res ^ mask) - mask);  /* do sign extension */
+    }
+  }
+  else if (size > SZINT) {  /* must check unread bytes */
+    int mask = (!issigned || (PackInt)res >= 0) ? 0 : MC;
+    for (i = limit; i < size; i++) {
+      if ((unsigned char)str[islittle ? i : size - 1 - i] != mask)
+        luaL_error(L, "%d-byte integer does not fit into Lua Integer", size);
+    }
+  }
+  return res;
+}
+
+
+static int str_unpack (lua_State *L) {
+  Header h;
+  const char *fmt = luaL_checkstring(L, 1);
+  size_t ld;
+  const char *data = luaL_checklstring(L, 2, &ld);
+  size_t pos = (size_t)posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+  int n = 0;  /* number of results */
+  luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  initheader(L, &h);
+  while (*fmt != '\0') {
+    int size, ntoalign;
+    KOption opt = getdetails(&h, pos, &fmt, &size, &ntoalign);
+    luaL_argcheck(L, (size_t)ntoalign + size <= ld - pos, 2,
+                    "data string too short");
+    pos += ntoalign;  /* skip alignment */
+    /* stack space for item + next position */
+    luaL_checkstack(L, 2, "too many results");
+    n++;
+    switch (opt) {
+      case Kint: {
+        PackUInt res = unpackint(L, data + pos, h.islittle, size, 1);
+        lua_pushnumber(L, (lua_Number)(PackInt)res);
+        break;
+      }
+      case Kuint: {
+        PackUInt res = unpackint(L, data + pos, h.islittle, size, 0);
+        lua_pushnumber(L, (lua_Number)res);
+        break;
+      }
+      case Kfloat: {
+        volatile Ftypes u;
+        lua_Number num;
+        copywithendian(u.buff, data + pos, size, h.islittle);
+        if (size == sizeof(u.f)) num = (lua_Number)u.f;
+        else if (size == sizeof(u.d)) num = (lua_Number)u.d;
+        else num = u.n;
+        lua_pushnumber(L, num);
+        break;
+      }
+      case Kchar: {
+        lua_pushlstring(L, data + pos, size);
+        break;
+      }
+      case Kstring: {
+        PackUInt len = unpackint(L, data + pos, h.islittle, size, 0);
+        luaL_argcheck(L, len <= ld - pos - size, 2, "data string too short");
+        lua_pushlstring(L, data + pos + size, (size_t)len);
+        pos += len;  /* skip string */
+        break;
+      }
+      case Kzstr: {
+        size_t len = strlen(data + pos);
+        luaL_argcheck(L, pos + len < ld, 2,
+                         "unfinished string for format " LUA_QL("z"));
+        lua_pushlstring(L, data + pos, len);
+        pos += len + 1;  /* skip string plus final '\0' */
+        break;
+      }
+      case Kpaddalign: case Kpadding: case Knop:
+        n--;  /* undo increment */
+        break;
+    }
+    pos += size;
+  }
+  lua_pushinteger(L, pos + 1);  /* next position */
+  return n + 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+/*
+** A string buffer accumulates pieces in one growable block, so that
+** building a string from n pieces costs O(total length) instead of the
+** O(n^2) of repeated `s = s .. piece'. The block is a userdata kept in
+** the environment of the buffer, so that the collector accounts for it.
+*/
+
+typedef struct StrBuf {
+  char *b;  /* contents (not '\0'-terminated) */
+  size_t n;  /* number of characters in the buffer */
+  size_t size;  /* size of block `b' */
+} StrBuf;
+
+
+#define MINSBSIZE	32  /* minimum size of a buffer block */
+
+#define checkstrbuf(L,i)  ((StrBuf *)luaL_checkudata(L, i, LUA_STRBUFHANDLE))
+
+
+/* ensures that `sb' (at index `idx') has room for `l' more characters */
+static char *sbprep (lua_State *L, int idx, StrBuf *sb, size_t l) {
+  if (sb->size - sb->n < l) {  /* not enough space? */
+    size_t newsize = sb->size * 2;  /* double buffer size */
+    char *nb;
+    if (l > ~(size_t)0 - sb->n)
+      luaL_error(L, "string buffer too large");
+    if (newsize < sb->n + l)  /* not big enough? */
+      newsize = sb->n + l;
+    if (newsize < MINSBSIZE)
+      newsize = MINSBSIZE;
+    nb = (char *)lua_newuserdata(L, newsize);
+    if (sb->n > 0)
+      memcpy(nb, sb->b, sb->n);
+    lua_getfenv(L, idx);
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, 1);  /* new block replaces the old one */
+    lua_pop(L, 1);
+    sb->b = nb;
+    sb->size = newsize;
+  }
+  return sb->b + sb->n;
+}
+
+
+static void sbadd (lua_State *L, StrBuf *sb, const char *s, size_t l) {
+  memcpy(sbprep(L, 1, sb, l), s, l);
+  sb->n += l;
+}
+
+
+static int sb_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuf *sb;
+  luaL_argcheck(L, size >= 0, 1, "size cannot be negative");
+  sb = (StrBuf *)lua_newuserdata(L, sizeof(StrBuf));
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_getmetatable(L, LUA_STRBUFHANDLE);
+  lua_setmetatable(L, -2);
+  lua_createtable(L, 1, 0);  /* environment, to keep the block */
+  lua_setfenv(L, -2);
+  if (size > 0)
+    sbprep(L, lua_gettop(L), sb, (size_t)size);  /* preallocate */
+  return 1;
+}
+
+
+/* b:add(...): appends each argument (strings or numbers) */
+static int sb_add (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  int n = lua_gettop(L);
+  int i;
+  for (i = 2; i <= n; i++) {
+    size_t l;
+    const char *s = luaL_checklstring(L, i, &l);
+    sbadd(L, sb, s, l);
+  }
+  lua_settop(L, 1);
+  return 1;  /* return the buffer, for chaining */
+}
+
+
+/* b:addf(fmt, ...): appends string.format(fmt, ...) */
+static int sb_addf (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  int top = lua_gettop(L);
+  const CFormat *cf = getformat(L, 2);
+  luaL_Buffer b;
+  size_t l;
+  const char *s;
+  luaL_buffinit(L, &b);
+  addformat(L, &b, 2, top, cf);
+  luaL_pushresult(&b);
+  s = lua_tolstring(L, -1, &l);
+  sbadd(L, sb, s, l);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int sb_tostring (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  lua_pushlstring(L, sb->b != NULL ? sb->b : "", sb->n);
+  return 1;
+}
+
+
+/* b:reset(): empties the buffer, keeping its block for reuse */
+static int sb_reset (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  sb->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int sb_len (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  lua_pushinteger(L, (lua_Integer)sb->n);
+  return 1;
+}
+
+
+static const luaL_Reg sblib[] = {
+  {"add", sb_add},
+  {"addf", sb_addf},
+  {"reset", sb_reset},
+  {"tostring", sb_tostring},
+  {"__len", sb_len},
+  {"__tostring", sb_tostring},
+  {NULL, NULL}
+};
+
+
+static void createstrbufmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_STRBUFHANDLE);  /* metatable for buffers */
+  lua_pushvalue(L, -1);  /* push metatable */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_register(L, NULL, sblib);
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg strlib[] = {
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
+  {"buffer", sb_new},
   {"find", str_find},
   {"format", str_format},
   {"gfind", gfind_nodef},
   {"gmatch", gmatch},
   {"gsub", str_gsub},
   {"len", str_len},
+  {"lines", str_lines},
   {"lower", str_lower},
   {"match", str_match},
+  {"pack", str_pack},
+  {"packsize", str_packsize},
   {"rep", str_rep},
   {"reverse", str_reverse},
+  {"split", str_split},
   {"sub", str_sub},
+  {"unpack", str_unpack},
   {"upper", str_upper},
   {NULL, NULL}
 };
@@ -860,12 +2131,27 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUALIB_API int luaopen_string (lua_State *L) {
+  lua_createtable(L, 3, 0);  /* environment of functions */
+  lua_createtable(L, 0, 1);  /* metatable for the caches */
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");  /* compiled items are weak */
+  lua_createtable(L, 0, 0);  /* cache of compiled patterns */
+  lua_pushvalue(L, -2);
+  lua_setmetatable(L, -2);
+  lua_rawseti(L, -3, PATTCACHE);
+  lua_createtable(L, 0, 0);  /* cache of compiled formats */
+  lua_pushvalue(L, -2);
+  lua_setmetatable(L, -2);
+  lua_rawseti(L, -3, FMTCACHE);
+  lua_pop(L, 1);  /* pop metatable */
+  lua_replace(L, LUA_ENVIRONINDEX);
   luaL_register(L, LUA_STRLIBNAME, strlib);
 #if defined(LUA_COMPAT_GFIND)
   lua_getfield(L, -1, "gmatch");
   lua_setfield(L, -2, "gfind");
 #endif
   createmetatable(L);
+  createstrbufmeta(L);
   return 1;
 }
 
@@ -32,6 +32,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
 
 
@@ -49,7 +50,7 @@
 
 #define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
   
-#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
+#define hashstr(t,str)  hashpow2(t, luaS_strhash(str))
 #define hashboolean(t,p)        hashpow2(t, p)
 
 
@@ -133,6 +134,16 @@ static int arrayindex (const TValue *key) {
 }
 
 
+/*
+** checks whether node `n' holds `key' (key may be dead already, but it
+** is ok to use it in `next')
+*/
+#define matchkey(n,key) \
+	(luaO_rawequalObj(key2tval(n), key) || \
+	 (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) && \
+	  gcvalue(gkey(n)) == gcvalue(key)))
+
+
 /*
 ** returns the index of a `key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
@@ -148,12 +159,13 @@ static int findindex (lua_State *L, Table *t, StkId key) {
     return i-1;  /* yes; that's the index (corrected to C) */
   //在hash表里的情况
   else {
-    Node *n = mainposition(t, key);
+    Node *n;
+    i = t->lastnext;
+    if (i < sizenode(t) && matchkey(gnode(t, i), key))
+      return i + t->sizearray;  /* traversal resumed where it stopped */
+    n = mainposition(t, key);
     do {  /* check whether `key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in `next' */
-      if (luaO_rawequalObj(key2tval(n), key) ||
-            (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
-             gcvalue(gkey(n)) == gcvalue(key))) {
+      if (matchkey(n, key)) {
         //计算key在hash表里的位置
         i = cast_int(n - gnode(t, 0));  /* key index in hash table */
         /* hash elements are numbered after array ones */
@@ -184,6 +196,7 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   //i - t->sizearray,求出hash下标的真正位置
   for (i -= t->sizearray; i < sizenode(t); i++) {  /* then hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
+      t->lastnext = i;  /* next call will most likely continue from here */
       setobj2s(L, key, key2tval(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
       return 1;
@@ -417,6 +430,8 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   /* temporary values (kept only if some malloc fails) */
   t->array = NULL;
   t->sizearray = 0;
+  t->lastnext = 0;
+  t->lastborder = 0;
   t->lsizenode = 0;
   t->node = cast(Node *, dummynode);
   setarrayvector(L, t, narray);
@@ -434,6 +449,66 @@ void luaH_free (lua_State *L, Table *t) {
   luaM_free(L, t);
 }
 
+/*
+** copies src[f..e] into dst[t..t+e-f], as a sequence of raw reads and
+** writes in the order that is correct for overlapping ranges. When both
+** ranges are inside the array parts, values are moved as one block.
+*/
+void luaH_move (lua_State *L, Table *src, int f, int e, Table *dst, int t) {
+  int n, i;
+  if (e < f) return;  /* empty range */
+  n = e - f + 1;
+  if (f >= 1 && e <= src->sizearray && t >= 1) {
+    if (t - 1 <= dst->sizearray && dst->sizearray - (t - 1) < n &&
+        n <= MAXASIZE - (t - 1))  /* destination extends the array part? */
+      luaH_resizearray(L, dst, t - 1 + n);  /* grow it to fit */
+    if (t - 1 <= dst->sizearray - n) {  /* both ranges in array parts? */
+      memmove(&dst->array[t - 1], &src->array[f - 1], n * sizeof(TValue));
+      if (src != dst && isblack(obj2gco(dst)))
+        luaC_barrierback(L, dst);  /* (there may be white values) */
+      return;
+    }
+  }
+  if (src == dst && f < t && t <= e) {  /* overlapping, moving up? */
+    for (i = n - 1; i >= 0; i--) {  /* then go backwards */
+      TValue v;
+      setobj(L, &v, luaH_getnum(src, f + i));
+      setobj2t(L, luaH_setnum(L, dst, t + i), &v);
+      luaC_barriert(L, dst, &v);
+    }
+  }
+  else {
+    for (i = 0; i < n; i++) {
+      TValue v;
+      setobj(L, &v, luaH_getnum(src, f + i));
+      setobj2t(L, luaH_setnum(L, dst, t + i), &v);
+      luaC_barriert(L, dst, &v);
+    }
+  }
+}
+
+
+/*
+** removes all entries from `t' but keeps both parts allocated, so that
+** the table can be refilled without going through `rehash' again
+*/
+void luaH_clear (Table *t) {
+  int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (t->node != dummynode) {
+    for (i = 0; i < sizenode(t); i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, sizenode(t));  /* all positions are free */
+  }
+  t->lastnext = 0;
+  t->lastborder = 0;
+}
+
 /*
  在hash表里，获得可用的node。
  设计中，把hash表里，lastfree指针指向最后一个可用的位置。
@@ -510,27 +585,49 @@ const TValue *luaH_getnum (Table *t, int key) {
     Node *n = hashnum(t, nk);
     //这里遍历碰撞链表，找到等于这个key的值
     do {  /* check whether `key' is somewhere in the chain */
+      Node *next = gnext(n);
+      luai_prefetch(next);
       if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
         return gval(n);  /* that's it */
-      else n = gnext(n);
+      else n = next;
     } while (n);
     return luaO_nilobject;
   }
 }
 
 
+/*
+** search function for long strings, which must be compared by contents
+*/
+static const TValue *getlngstr (Table *t, TString *key) {
+  Node *n = hashstr(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisstring(gkey(n)) && luaS_eqlngstr(rawtsvalue(key2tval(n)), key))
+      return gval(n);  /* that's it */
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
 /*
 ** search function for strings
  通过字符key，在hash表里找到对应的值
 */
 const TValue *luaH_getstr (Table *t, TString *key) {
+  Node *n;
+  if (!isshortstr(key))  /* long strings are not internalized */
+    return getlngstr(t, key);
   //找到对应key的node
-  Node *n = hashstr(t, key);
+  n = hashstr(t, key);
   //遍历此node的碰撞链表，如果链表上的node的key值与当前key相等，则取出此值
   do {  /* check whether `key' is somewhere in the chain */
-    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
+    Node *next = gnext(n);
+    luai_prefetch(next);  /* overlap the next miss with this compare */
+    /* compare the pointers first: a match is (almost) never a false hit */
+    if (gkey(n)->value.gc == obj2gco(key) && ttisstring(gkey(n)))
       return gval(n);  /* that's it */
-    else n = gnext(n);
+    else n = next;
   } while (n);
   return luaO_nilobject;
 }
@@ -644,14 +741,29 @@ static int unbound_search (Table *t, unsigned int j) {
 int luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
   if (j > 0 && ttisnil(&t->array[j - 1])) {
-    /* there is a boundary in the array part: (binary) search for it */
+    /* there is a boundary in the array part */
     unsigned int i = 0;
+    unsigned int h = cast(unsigned int, t->lastborder);
+    if (h < j) {  /* try the previous border and its neighbours first */
+      if (h == 0 || !ttisnil(&t->array[h - 1])) {  /* t[h] present? */
+        if (ttisnil(&t->array[h]))
+          return h;  /* still a border */
+        else if (ttisnil(&t->array[h + 1]))  /* (h + 1 < j here) */
+          return t->lastborder = h + 1;  /* one element was appended */
+        i = h + 1;  /* border is above the hint */
+      }
+      else if (h == 1 || !ttisnil(&t->array[h - 2]))
+        return t->lastborder = h - 1;  /* last element was removed */
+      else
+        j = h - 1;  /* border is below the hint */
+    }
+    /* (binary) search for it */
     while (j - i > 1) {
       unsigned int m = (i+j)/2;
       if (ttisnil(&t->array[m - 1])) j = m;
       else i = m;
     }
-    return i;
+    return t->lastborder = i;
   }
   /* else must find a boundary in hash part */
   else if (t->node == dummynode)  /* hash part is empty? */
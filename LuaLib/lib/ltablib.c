@@ -5,7 +5,9 @@
 */
 
 
+#include <limits.h>
 #include <stddef.h>
+#include <string.h>
 
 #define ltablib_c
 #define LUA_LIB
@@ -88,6 +90,23 @@ static int setn (lua_State *L) {
 }
 
 
+static int tnew (lua_State *L) {
+  int narray = luaL_optint(L, 1, 0);
+  int nhash = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narray >= 0, 1, "size cannot be negative");
+  luaL_argcheck(L, nhash >= 0, 2, "size cannot be negative");
+  lua_createtable(L, narray, nhash);
+  return 1;
+}
+
+
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
 static int tinsert (lua_State *L) {
   int e = aux_getn(L, 1) + 1;  /* first empty element */
   int pos;  /* where to insert new element */
@@ -97,12 +116,12 @@ static int tinsert (lua_State *L) {
       break;
     }
     case 3: {
-      int i;
       pos = luaL_checkint(L, 2);  /* 2nd argument is the position */
       if (pos > e) e = pos;  /* `grow' array if necessary */
-      for (i = e; i > pos; i--) {  /* move up elements */
-        lua_rawgeti(L, 1, i-1);
-        lua_rawseti(L, 1, i);  /* t[i] = t[i-1] */
+      if (e > pos) {  /* move up elements */
+        lua_rawgeti(L, 1, e-1);
+        lua_rawseti(L, 1, e);  /* t[e] = t[e-1] (may grow the table) */
+        lua_rawmove(L, 1, pos, e-2, pos+1, 1);  /* shift the rest up */
       }
       break;
     }
@@ -123,41 +142,125 @@ static int tremove (lua_State *L) {
    return 0;  /* nothing to remove */
   luaL_setn(L, 1, e - 1);  /* t.n = n-1 */
   lua_rawgeti(L, 1, pos);  /* result = t[pos] */
-  for ( ;pos<e; pos++) {
-    lua_rawgeti(L, 1, pos+1);
-    lua_rawseti(L, 1, pos);  /* t[pos] = t[pos+1] */
-  }
+  lua_rawmove(L, 1, pos+1, e, pos, 1);  /* t[pos..e-1] = t[pos+1..e] */
   lua_pushnil(L);
   lua_rawseti(L, 1, e);  /* t[e] = nil */
   return 1;
 }
 
 
-static void addfield (lua_State *L, luaL_Buffer *b, int i) {
+/*
+** table.move(a1, f, e, t [, a2]): a2[t..t+e-f] = a1[f..e], with raw
+** accesses; returns a2 (which defaults to a1)
+*/
+static int tmove (lua_State *L) {
+  int f = luaL_checkint(L, 2);
+  int e = luaL_checkint(L, 3);
+  int t = luaL_checkint(L, 4);
+  int tt = !lua_isnoneornil(L, 5) ? 5 : 1;  /* destination table */
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, tt, LUA_TTABLE);
+  if (e >= f) {  /* otherwise, nothing to move */
+    luaL_argcheck(L, f > 0 || e < INT_MAX + f, 3,
+                  "too many elements to move");
+    luaL_argcheck(L, t <= INT_MAX - (e - f), 4,
+                  "destination wrap around");
+    lua_rawmove(L, 1, f, e, t, tt);
+  }
+  lua_pushvalue(L, tt);
+  return 1;
+}
+
+
+/*
+** returns the length of field `i' once converted to a string; for a
+** number, only an upper bound, and `*exact' is cleared
+*/
+static size_t fieldlen (lua_State *L, int i, int *exact) {
+  size_t l = 0;
   lua_rawgeti(L, 1, i);
-  if (!lua_isstring(L, -1))
-    luaL_error(L, "invalid value (%s) at index %d in table for "
-                  LUA_QL("concat"), luaL_typename(L, -1), i);
-    luaL_addvalue(b);
+  switch (lua_type(L, -1)) {
+    case LUA_TSTRING: l = lua_objlen(L, -1); break;
+    case LUA_TNUMBER: l = LUAI_MAXNUMBER2STR; *exact = 0; break;
+    default:
+      luaL_error(L, "invalid value (%s) at index %d in table for "
+                    LUA_QL("concat"), luaL_typename(L, -1), i);
+  }
+  lua_pop(L, 1);
+  return l;
 }
 
 
+/* copies field `i' to `p'; returns a pointer to the end of the copy */
+static char *addfield (lua_State *L, char *p, int i) {
+  lua_rawgeti(L, 1, i);
+  if (lua_type(L, -1) == LUA_TNUMBER) {  /* format it in place */
+    lua_number2str(p, lua_tonumber(L, -1));
+    p += strlen(p);
+  }
+  else {
+    size_t l;
+    const char *s = lua_tolstring(L, -1, &l);
+    memcpy(p, s, l);
+    p += l;
+  }
+  lua_pop(L, 1);
+  return p;
+}
+
+
+static char *addfields (lua_State *L, char *p, int i, int last,
+                        const char *sep, size_t lsep) {
+  p = addfield(L, p, i);
+  while (i < last) {
+    memcpy(p, sep, lsep);
+    p = addfield(L, p + lsep, ++i);
+  }
+  return p;
+}
+
+
+/*
+** First pass measures the result, so that it is built in a single
+** block instead of being accumulated in LUAL_BUFFERSIZE pieces: in the
+** buffer itself when it is small enough, otherwise directly in the new
+** string. Numbers are measured only by an upper bound (formatting them
+** twice costs more than a copy), so a large result with numbers is
+** built in a scratch block and then copied, being held twice at peak.
+*/
 static int tconcat (lua_State *L) {
-  luaL_Buffer b;
-  size_t lsep;
-  int i, last;
+  size_t lsep, total;
+  int i, last, k;
+  int exact = 1;
   const char *sep = luaL_optlstring(L, 2, "", &lsep);
   luaL_checktype(L, 1, LUA_TTABLE);
   i = luaL_optint(L, 3, 1);
   last = luaL_opt(L, luaL_checkint, 4, luaL_getn(L, 1));
-  luaL_buffinit(L, &b);
-  for (; i < last; i++) {
-    addfield(L, &b, i);
-    luaL_addlstring(&b, sep, lsep);
-  }
-  if (i == last)  /* add last value (if interval was not empty) */
-    addfield(L, &b, i);
-  luaL_pushresult(&b);
+  if (i > last) {  /* empty interval? */
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  total = fieldlen(L, i, &exact);
+  for (k = i; k < last; ) {
+    size_t l = lsep + fieldlen(L, ++k, &exact);
+    if (l < lsep || total + l < total)
+      luaL_error(L, "resulting string too large");
+    total += l;
+  }
+  if (total <= LUAL_BUFFERSIZE) {
+    luaL_Buffer b;
+    char *buff;
+    luaL_buffinit(L, &b);
+    buff = luaL_prepbuffer(&b);
+    luaL_addsize(&b, addfields(L, buff, i, last, sep, lsep) - buff);
+    luaL_pushresult(&b);
+  }
+  else if (exact)  /* only strings: `total' is their length */
+    addfields(L, lua_newstring(L, total), i, last, sep, lsep);
+  else {
+    char *buff = (char *)lua_newuserdata(L, total);
+    lua_pushlstring(L, buff, addfields(L, buff, i, last, sep, lsep) - buff);
+  }
   return 1;
 }
 
@@ -168,6 +271,9 @@ static int tconcat (lua_State *L) {
 ** Quicksort
 ** (based on `Algorithms in MODULA-3', Robert Sedgewick;
 **  Addison-Wesley, 1993.)
+** Recursion depth is bounded: a range that is still unsorted after
+** 2*log2(n) partitions is finished with heapsort, so the sort is
+** O(n log n) even for adversarial inputs or order functions.
 */
 
 
@@ -191,9 +297,49 @@ static int sort_comp (lua_State *L, int a, int b) {
     return lua_lessthan(L, a, b);
 }
 
-static void auxsort (lua_State *L, int l, int u) {
+static void siftdown (lua_State *L, int l, int i, int u) {
+  for (;;) {  /* a[i] is the root of a heap stored in a[l..u] */
+    int c = l + 2*(i-l) + 1;  /* first child */
+    if (c > u) break;
+    lua_rawgeti(L, 1, c);
+    if (c < u) {
+      lua_rawgeti(L, 1, c+1);
+      if (sort_comp(L, -2, -1)) {  /* a[c]<a[c+1]? */
+        lua_remove(L, -2);  /* keep the larger child */
+        c++;
+      }
+      else
+        lua_pop(L, 1);
+    }
+    lua_rawgeti(L, 1, i);
+    if (!sort_comp(L, -1, -2)) {  /* a[i]>=a[c]? */
+      lua_pop(L, 2);
+      break;
+    }
+    set2(L, c, i);  /* swap a[i] - a[c] */
+    i = c;
+  }
+}
+
+static void heapsort (lua_State *L, int l, int u) {
+  int i;
+  for (i = l + (u-l)/2; i >= l; i--)
+    siftdown(L, l, i, u);
+  for (i = u; i > l; i--) {
+    lua_rawgeti(L, 1, l);
+    lua_rawgeti(L, 1, i);
+    set2(L, l, i);  /* move largest element to the end */
+    siftdown(L, l, l, i-1);
+  }
+}
+
+static void auxsort (lua_State *L, int l, int u, int depth) {
   while (l < u) {  /* for tail recursion */
     int i, j;
+    if (depth-- == 0) {  /* too many bad partitions? */
+      heapsort(L, l, u);
+      break;
+    }
     /* sort elements a[l], a[(l+u)/2] and a[u] */
     lua_rawgeti(L, 1, l);
     lua_rawgeti(L, 1, u);
@@ -250,33 +396,418 @@ static void auxsort (lua_State *L, int l, int u) {
     else {
       j=i+1; i=u; u=j-2;
     }
-    auxsort(L, j, i);  /* call recursively the smaller one */
+    auxsort(L, j, i, depth);  /* call recursively the smaller one */
   }  /* repeat the routine for the larger one */
 }
 
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Sorting of keys in C
+** When all values to be compared are numbers (or all are strings),
+** they are read once into a C array and sorted there, without an
+** API round trip per comparison or per swap.
+*/
+
+#define SK_NUMBER	1  /* keys are numbers */
+#define SK_STRING	2  /* keys are strings */
+
+/* below this size, ranges are finished with insertion sort */
+#define SK_SMALL	16
+
+
+typedef struct SortKey {
+  union {
+    lua_Number n;
+    const char *s;
+  } u;
+  size_t l;  /* length of string keys */
+  int pos;  /* original position of the value owning this key */
+} SortKey;
+
+
+/*
+** same order as `l_strcmp' in lvm.c (and so as the `<' operator)
+*/
+static int sk_strcmp (const char *l, size_t ll, const char *r, size_t lr) {
+  for (;;) {
+    int temp = strcoll(l, r);
+    if (temp != 0) return temp;
+    else {  /* strings are equal up to a `\0' */
+      size_t len = strlen(l);  /* index of first `\0' in both strings */
+      if (len == lr)  /* r is finished? */
+        return (len == ll) ? 0 : 1;
+      else if (len == ll)  /* l is finished? */
+        return -1;  /* l is smaller than r (because r is not finished) */
+      /* both strings longer than `len'; go on comparing (after the `\0') */
+      len++;
+      l += len; ll -= len; r += len; lr -= len;
+    }
+  }
+}
+
+
+#define sk_less(kind,a,b) \
+	((kind) == SK_NUMBER ? (a)->u.n < (b)->u.n : \
+	  sk_strcmp((a)->u.s, (a)->l, (b)->u.s, (b)->l) < 0)
+
+
+/*
+** pops a value into `k'; returns the kind of the key or 0 if it cannot
+** be compared in C. The value must be anchored somewhere else while
+** `k' is in use.
+*/
+static int sk_get (lua_State *L, SortKey *k, int pos) {
+  int kind = 0;
+  switch (lua_type(L, -1)) {
+    case LUA_TNUMBER: {
+      k->u.n = lua_tonumber(L, -1);
+      if (k->u.n == k->u.n)  /* not a NaN? */
+        kind = SK_NUMBER;
+      break;
+    }
+    case LUA_TSTRING: {
+      k->u.s = lua_tolstring(L, -1, &k->l);
+      kind = SK_STRING;
+      break;
+    }
+  }
+  k->pos = pos;
+  lua_pop(L, 1);
+  return kind;
+}
+
+
+static void sk_siftdown (SortKey *a, int r, int n, int kind) {
+  SortKey t = a[r];
+  for (;;) {
+    int c = 2*r + 1;
+    if (c >= n) break;
+    if (c + 1 < n && sk_less(kind, &a[c], &a[c+1])) c++;
+    if (!sk_less(kind, &t, &a[c])) break;
+    a[r] = a[c]; r = c;
+  }
+  a[r] = t;
+}
+
+
+static void sk_heapsort (SortKey *a, int n, int kind) {
+  int i;
+  for (i = n/2 - 1; i >= 0; i--)
+    sk_siftdown(a, i, n, kind);
+  for (i = n - 1; i > 0; i--) {
+    SortKey t = a[i]; a[i] = a[0]; a[0] = t;  /* move largest to the end */
+    sk_siftdown(a, 0, i, kind);
+  }
+}
+
+
+static void sk_insertion (SortKey *a, int l, int u, int kind) {
+  int i;
+  for (i = l + 1; i <= u; i++) {
+    SortKey t = a[i];
+    int j = i;
+    for (; j > l && sk_less(kind, &t, &a[j-1]); j--)
+      a[j] = a[j-1];
+    a[j] = t;
+  }
+}
+
+
+/*
+** introsort: quicksort with median-of-three pivots, heapsort when the
+** recursion gets too deep and insertion sort for small ranges
+*/
+static void sk_sort (SortKey *a, int l, int u, int depth, int kind) {
+  while (u - l > SK_SMALL) {
+    int i, j, m;
+    SortKey p, t;
+    if (depth-- == 0) {
+      sk_heapsort(a + l, u - l + 1, kind);
+      return;
+    }
+    m = l + (u - l)/2;
+    /* order a[l] <= a[m] <= a[u]; they are sentinels for the scans */
+    if (sk_less(kind, &a[m], &a[l])) { t = a[m]; a[m] = a[l]; a[l] = t; }
+    if (sk_less(kind, &a[u], &a[m])) {
+      t = a[u]; a[u] = a[m]; a[m] = t;
+      if (sk_less(kind, &a[m], &a[l])) { t = a[m]; a[m] = a[l]; a[l] = t; }
+    }
+    p = a[m];
+    i = l; j = u;
+    for (;;) {  /* invariant: a[l..i] <= P <= a[j..u] */
+      do i++; while (sk_less(kind, &a[i], &p));
+      do j--; while (sk_less(kind, &p, &a[j]));
+      if (i >= j) break;
+      t = a[i]; a[i] = a[j]; a[j] = t;
+    }
+    /* a[l..j] <= P <= a[j+1..u]; recurse into the smaller half */
+    if (j - l < u - j) {
+      sk_sort(a, l, j, depth, kind);
+      l = j + 1;
+    }
+    else {
+      sk_sort(a, j + 1, u, depth, kind);
+      u = j;
+    }
+  }
+  sk_insertion(a, l, u, kind);
+}
+
+
+static int sortdepth (int n) {
+  int d = 0;
+  while (n > 1) { n >>= 1; d += 2; }
+  return d;
+}
+
+
+/*
+** moves element `a[i].pos' of the table to position i+1, for all `i',
+** and removes the keys (at the top of the stack). Elements go through
+** a copy, so that all of them stay anchored while the table is
+** rewritten.
+*/
+static void sk_permute (lua_State *L, const SortKey *a, int n) {
+  int i;
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    lua_rawgeti(L, 1, a[i].pos);
+    lua_rawseti(L, -2, i+1);
+  }
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, -1, i);
+    lua_rawseti(L, 1, i);
+  }
+  lua_pop(L, 2);  /* remove copy and keys */
+}
+
+
+/*
+** tries to sort a[1..n] in C; returns 0 (leaving the table untouched)
+** when the values are not all numbers or all strings
+*/
+static int sortkeys (lua_State *L, int n) {
+  int i, kind = 0;
+  SortKey *a = (SortKey *)lua_newuserdata(L, n * sizeof(SortKey));
+  for (i = 0; i < n; i++) {
+    int k;
+    lua_rawgeti(L, 1, i+1);
+    k = sk_get(L, &a[i], i+1);
+    if (k == 0 || (kind != 0 && k != kind)) {
+      lua_pop(L, 1);  /* remove keys */
+      return 0;
+    }
+    kind = k;
+  }
+  sk_sort(a, 0, n - 1, sortdepth(n), kind);
+  if (kind == SK_NUMBER) {
+    for (i = 0; i < n; i++) {
+      lua_pushnumber(L, a[i].u.n);
+      lua_rawseti(L, 1, i+1);
+    }
+    lua_pop(L, 1);  /* remove keys */
+  }
+  else
+    sk_permute(L, a, n);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Stable sorting
+** Bottom-up merge sort: runs of SK_SMALL elements are sorted by
+** insertion, then merged pairwise; a merge is skipped when both runs
+** are already in order, so (partially) sorted input is cheap.
+*/
+
+#define SK_VALUE	3  /* keys must be compared through Lua */
+
+
+typedef struct SortState {
+  lua_State *L;
+  int kind;  /* kind of the keys */
+  int values;  /* stack index of the table with the SK_VALUE keys */
+  int comp;  /* stack index of the order function (0 if none) */
+} SortState;
+
+
+static int ms_lessvalue (SortState *S, const SortKey *a, const SortKey *b) {
+  lua_State *L = S->L;
+  int res;
+  if (S->comp) lua_pushvalue(L, S->comp);
+  lua_rawgeti(L, S->values, a->pos);
+  lua_rawgeti(L, S->values, b->pos);
+  if (S->comp) {
+    lua_call(L, 2, 1);
+    res = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  else {
+    res = lua_lessthan(L, -2, -1);
+    lua_pop(L, 2);
+  }
+  return res;
+}
+
+
+#define ms_less(S,a,b) \
+	((S)->kind == SK_VALUE ? ms_lessvalue(S, a, b) : sk_less((S)->kind, a, b))
+
+
+static void ms_insertion (SortState *S, SortKey *a, int l, int u) {
+  int i;
+  for (i = l + 1; i <= u; i++) {
+    SortKey t = a[i];
+    int j = i;
+    for (; j > l && ms_less(S, &t, &a[j-1]); j--)  /* equal keys stay */
+      a[j] = a[j-1];
+    a[j] = t;
+  }
+}
+
+
+/* merges the sorted runs a[l..m-1] and a[m..u-1] */
+static void ms_merge (SortState *S, SortKey *a, SortKey *buff,
+                      int l, int m, int u) {
+  int i = 0, j = m, k = l;
+  int nl = m - l;
+  memcpy(buff, a + l, nl * sizeof(SortKey));
+  while (i < nl && j < u) {
+    if (ms_less(S, &a[j], &buff[i]))  /* take from the left run on ties */
+      a[k++] = a[j++];
+    else
+      a[k++] = buff[i++];
+  }
+  while (i < nl)
+    a[k++] = buff[i++];
+}
+
+
+static void ms_sort (SortState *S, SortKey *a, SortKey *buff, int n) {
+  int i, w;
+  for (i = 0; i < n; i += SK_SMALL)
+    ms_insertion(S, a, i, (i + SK_SMALL < n ? i + SK_SMALL : n) - 1);
+  for (w = SK_SMALL; w < n; w *= 2) {
+    for (i = 0; i + w < n; i += 2*w) {
+      int m = i + w;
+      int u = (m + w < n) ? m + w : n;
+      if (ms_less(S, &a[m], &a[m-1]))  /* runs not already in order? */
+        ms_merge(S, a, buff, i, m, u);
+    }
+  }
+}
+
+
+/*
+** sorts the keys at the top of the stack (one per element of the
+** table) and moves the table elements into the resulting order
+*/
+static void stablesort_aux (lua_State *L, int n, int kind, int values,
+                            int comp) {
+  SortState S;
+  SortKey *a = (SortKey *)lua_touserdata(L, -1);
+  SortKey *buff = (SortKey *)lua_newuserdata(L, n * sizeof(SortKey));
+  S.L = L; S.kind = kind; S.values = values; S.comp = comp;
+  ms_sort(&S, a, buff, n);
+  lua_pop(L, 1);  /* remove buffer */
+  sk_permute(L, a, n);
+}
+
+
+/* reads the keys from the elements; returns their common kind */
+static int ms_getkeys (lua_State *L, SortKey *a, int n, int field) {
+  int i, kind = 0;
+  for (i = 0; i < n; i++) {
+    int k;
+    lua_rawgeti(L, 1, i+1);
+    if (field) {  /* key is a field of the element? */
+      lua_pushvalue(L, field);
+      lua_gettable(L, -2);
+      lua_remove(L, -2);  /* remove element */
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, field + 1, i+1);  /* anchor key */
+    }
+    k = sk_get(L, &a[i], i+1);
+    if (k == 0 || (kind != 0 && k != kind))
+      kind = SK_VALUE;  /* keep reading, to anchor all keys */
+    else if (kind == 0)
+      kind = k;
+  }
+  return kind;
+}
+
+
+static int stablesort (lua_State *L) {
+  int n = aux_getn(L, 1);
+  int kind = SK_VALUE;
+  SortKey *a;
+  if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+  lua_settop(L, 2);
+  if (n < 2) return 0;
+  a = (SortKey *)lua_newuserdata(L, n * sizeof(SortKey));
+  if (lua_isnil(L, 2))
+    kind = ms_getkeys(L, a, n, 0);
+  else {  /* keys are the elements themselves, compared by the function */
+    int i;
+    for (i = 0; i < n; i++) a[i].pos = i+1;
+  }
+  stablesort_aux(L, n, kind, 1, lua_isnil(L, 2) ? 0 : 2);
+  return 0;
+}
+
+
+static int sortby (lua_State *L) {
+  int n = aux_getn(L, 1);
+  int kind;
+  SortKey *a;
+  luaL_checkany(L, 2);
+  lua_settop(L, 2);
+  if (n < 2) return 0;
+  lua_createtable(L, n, 0);  /* keys (index 3) */
+  a = (SortKey *)lua_newuserdata(L, n * sizeof(SortKey));
+  kind = ms_getkeys(L, a, n, 2);
+  stablesort_aux(L, n, kind, 3, 0);
+  return 0;
+}
+
+/* }====================================================== */
+
 static int sort (lua_State *L) {
   int n = aux_getn(L, 1);
   luaL_checkstack(L, 40, "");  /* assume array is smaller than 2^40 */
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
   lua_settop(L, 2);  /* make sure there is two arguments */
-  auxsort(L, 1, n);
+  if (n < 2 || (lua_isnil(L, 2) && sortkeys(L, n)))
+    return 0;
+  auxsort(L, 1, n, sortdepth(n));
   return 0;
 }
 
-/* }====================================================== */
-
 
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
   {"foreach", foreach},
   {"foreachi", foreachi},
   {"getn", getn},
   {"maxn", maxn},
+  {"move", tmove},
+  {"new", tnew},
   {"insert", tinsert},
   {"remove", tremove},
   {"setn", setn},
   {"sort", sort},
+  {"sortby", sortby},
+  {"stablesort", stablesort},
   {NULL, NULL}
 };
 
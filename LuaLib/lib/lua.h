@@ -26,6 +26,9 @@
 /* mark for precompiled code (`<esc>Lua') */
 #define	LUA_SIGNATURE	"\033Lua"
 
+/* format byte of a chunk image (see `lua_dumpimage'), after the version */
+#define LUA_IMAGEFORMAT	1
+
 /* option for multiple returns in `lua_pcall' and `lua_call' */
 #define LUA_MULTRET	(-1)
 
@@ -82,6 +85,16 @@ typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 #define LUA_TTHREAD		8
 
 
+/*
+** element types of typed arrays
+*/
+#define LUA_TANONE		0
+#define LUA_TAFLOAT64		1
+#define LUA_TAFLOAT32		2
+#define LUA_TAINT32		3
+#define LUA_TAUINT8		4
+
+
 
 /* minimum Lua stack available to a C function */
 #define LUA_MINSTACK	20
@@ -150,6 +163,8 @@ LUA_API const char     *(lua_tolstring) (lua_State *L, int idx, size_t *len);
 LUA_API size_t          (lua_objlen) (lua_State *L, int idx);
 LUA_API lua_CFunction   (lua_tocfunction) (lua_State *L, int idx);
 LUA_API void	       *(lua_touserdata) (lua_State *L, int idx);
+LUA_API void	       *(lua_totypedarray) (lua_State *L, int idx, int *atype,
+                                            size_t *n);
 LUA_API lua_State      *(lua_tothread) (lua_State *L, int idx);
 LUA_API const void     *(lua_topointer) (lua_State *L, int idx);
 
@@ -161,6 +176,7 @@ LUA_API void  (lua_pushnil) (lua_State *L);
 LUA_API void  (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void  (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API void  (lua_pushlstring) (lua_State *L, const char *s, size_t l);
+LUA_API void  (lua_pushsubstring) (lua_State *L, int idx, size_t i, size_t l);
 LUA_API void  (lua_pushstring) (lua_State *L, const char *s);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
@@ -180,6 +196,8 @@ LUA_API void  (lua_rawget) (lua_State *L, int idx);
 LUA_API void  (lua_rawgeti) (lua_State *L, int idx, int n);
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
 LUA_API void *(lua_newuserdata) (lua_State *L, size_t sz);
+LUA_API char *(lua_newstring) (lua_State *L, size_t len);
+LUA_API void *(lua_newtypedarray) (lua_State *L, int atype, size_t n);
 LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_getfenv) (lua_State *L, int idx);
 
@@ -203,8 +221,11 @@ LUA_API int   (lua_pcall) (lua_State *L, int nargs, int nresults, int errfunc);
 LUA_API int   (lua_cpcall) (lua_State *L, lua_CFunction func, void *ud);
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                                         const char *chunkname);
+LUA_API int   (lua_loadimage) (lua_State *L, const char *image, size_t size,
+                                             const char *chunkname);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
+LUA_API int (lua_dumpimage) (lua_State *L, lua_Writer writer, void *data);
 
 
 /*
@@ -237,6 +258,9 @@ LUA_API int (lua_gc) (lua_State *L, int what, int data);
 LUA_API int   (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
+LUA_API void  (lua_rawmove) (lua_State *L, int a1, int f, int e, int t,
+                             int a2);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 
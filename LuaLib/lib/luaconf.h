@@ -56,6 +56,50 @@
 #define LUA_USE_ISATTY
 #define LUA_USE_POPEN
 #define LUA_USE_ULONGJMP
+#define LUA_USE_MMAP
+#endif
+
+
+/*
+@@ LUA_USE_SSE2 enables the use of SSE2 instructions in the string
+@* library (substring search).
+** CHANGE it (undefine it) if you do not want Lua to use them. It is
+** defined by default when the compiler targets SSE2.
+*/
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(LUA_ANSI)
+#define LUA_USE_SSE2
+#endif
+
+
+/*
+@@ LUA_USE_OPTIMIZER runs an optimizer over the code of each function
+@* compiled from source (see `luaK_optimize' in lcode.c).
+** CHANGE it (define it) if you want tighter code at a small cost in
+** compilation time. Line hooks may then see fewer events.
+*/
+/* #define LUA_USE_OPTIMIZER */
+
+
+/*
+@@ LUA_USE_CODECACHE keeps, for the whole process, the compiled code of
+@* each chunk loaded from source, so that loading the same chunk (same
+@* name and contents) again skips the compiler.
+** CHANGE it (define it) if your states load the same scripts over and
+** over. If states run in several threads, also define luai_cachelock
+** and luai_cacheunlock (below) to lock a mutex.
+*/
+/* #define LUA_USE_CODECACHE */
+
+
+/*
+@@ luai_cachelock/luai_cacheunlock lock what is shared by all states in
+@* the process: the compile cache (LUA_USE_CODECACHE) and the files kept
+@* mapped by luaL_loadimage.
+** CHANGE them to lock a mutex if states run in several threads.
+*/
+#ifndef luai_cachelock
+#define luai_cachelock()	((void) 0)
+#define luai_cacheunlock()	((void) 0)
 #endif
 
 
@@ -482,6 +526,15 @@
 #define LUAI_MAXUPVALUES	60
 
 
+/*
+@@ LUAI_MAXSHORTLEN is the maximum length for short strings, that is,
+@* strings that are internalized. (Cannot be smaller than reserved words
+@* or tags for metamethods, as these strings must be internalized;
+@* #("function") = 8, #("__newindex") = 10.)
+*/
+#define LUAI_MAXSHORTLEN	40
+
+
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
 */
@@ -520,10 +573,26 @@
 */
 #define LUA_NUMBER_SCAN		"%lf"
 #define LUA_NUMBER_FMT		"%.14g"
-#define lua_number2str(s,n)	sprintf((s), LUA_NUMBER_FMT, (n))
-#define LUAI_MAXNUMBER2STR	32 /* 16 digits, sign, point, and \0 */
+#define LUAI_MAXNUMBER2STR	32 /* 17 digits, sign, point, exponent, \0 */
 #define lua_str2number(s,p)	strtod((s), (p))
 
+/*
+@@ LUA_NUMBER_ROUNDTRIP makes lua_number2str write the shortest string
+@* (at most 17 digits) that reads back as the same number.
+** CHANGE it (define it) if you need conversions that do not lose
+** precision; by default, numbers are written with LUA_NUMBER_FMT, as in
+** previous versions. (Integral values up to 1e14 are written the same
+** way in both modes; the core writes them without `sprintf'.)
+*/
+#if defined(LUA_NUMBER_ROUNDTRIP)
+#define lua_number2str(s,n) \
+	(sprintf((s), "%.15g", (n)), lua_str2number((s), NULL) == (n) ? 0 : \
+	(sprintf((s), "%.16g", (n)), lua_str2number((s), NULL) == (n) ? 0 : \
+	 sprintf((s), "%.17g", (n))))
+#else
+#define lua_number2str(s,n)	sprintf((s), LUA_NUMBER_FMT, (n))
+#endif
+
 
 /*
 @@ The luai_num* macros define the primitive operations over numbers.
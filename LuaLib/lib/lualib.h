@@ -28,6 +28,7 @@ LUALIB_API int (luaopen_io) (lua_State *L);
 LUALIB_API int (luaopen_os) (lua_State *L);
 
 #define LUA_STRLIBNAME	"string"
+#define LUA_STRBUFHANDLE	"STRBUF*"
 LUALIB_API int (luaopen_string) (lua_State *L);
 
 #define LUA_MATHLIBNAME	"math"
@@ -39,6 +40,13 @@ LUALIB_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUALIB_API int (luaopen_package) (lua_State *L);
 
+#define LUA_UTF8LIBNAME	"utf8"
+LUALIB_API int (luaopen_utf8) (lua_State *L);
+
+#define LUA_ARRAYLIBNAME	"array"
+#define LUA_ARRAYHANDLE		"ARRAY*"
+LUALIB_API int (luaopen_array) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
@@ -14,6 +14,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstring.h"
@@ -25,6 +26,9 @@ typedef struct {
  ZIO* Z;
  Mbuffer* b;
  const char* name;
+ size_t pos;				/* bytes read so far */
+ int aligned;				/* chunk is an image? */
+ int inplace;				/* use its vectors in place? */
 } LoadState;
 
 #ifdef LUAC_TRUST_BINARIES
@@ -49,6 +53,29 @@ static void LoadBlock(LoadState* S, void* b, size_t size)
 {
  size_t r=luaZ_read(S->Z,b,size);
  IF (r!=0, "unexpected end");
+ S->pos+=size;
+}
+
+/* skip the padding before a vector in an image */
+static void LoadPad(LoadState* S)
+{
+ if (S->aligned)
+ {
+  char pad[LUAC_IMAGEALIGN];
+  LoadBlock(S,pad,(0-S->pos)&(LUAC_IMAGEALIGN-1));
+ }
+}
+
+/* return a vector of the image in place, skipping it */
+static const char* LoadInPlace(LoadState* S, size_t n, size_t size)
+{
+ ZIO* Z=S->Z;
+ const char* b=Z->p;
+ IF (n>Z->n/size, "unexpected end");
+ Z->p+=n*size;
+ Z->n-=n*size;
+ S->pos+=n*size;
+ return b;
 }
 
 static int LoadChar(LoadState* S)
@@ -79,6 +106,11 @@ static TString* LoadString(LoadState* S)
  LoadVar(S,size);
  if (size==0)
   return NULL;
+ else if (S->inplace)
+ {
+  const char* s=LoadInPlace(S,size,1);
+  return luaS_newlstr(S->L,s,size-1);		/* remove trailing '\0' */
+ }
  else
  {
   char* s=luaZ_openspace(S->L,S->b,size);
@@ -90,12 +122,22 @@ static TString* LoadString(LoadState* S)
 static void LoadCode(LoadState* S, Proto* f)
 {
  int n=LoadInt(S);
- f->code=luaM_newvector(S->L,n,Instruction);
- f->sizecode=n;
- LoadVector(S,f->code,n,sizeof(Instruction));
+ LoadPad(S);
+ if (f->inimage)
+ {
+  f->code=cast(Instruction*,LoadInPlace(S,n,sizeof(Instruction)));
+  f->sizecode=n;
+ }
+ else
+ {
+  f->code=luaM_newvector(S->L,n,Instruction);
+  f->sizecode=n;
+  LoadVector(S,f->code,n,sizeof(Instruction));
+ }
 }
 
 static Proto* LoadFunction(LoadState* S, TString* p);
+static Proto* LoadStub(LoadState* S, TString* p);
 
 static void LoadConstants(LoadState* S, Proto* f)
 {
@@ -131,16 +173,26 @@ static void LoadConstants(LoadState* S, Proto* f)
  f->p=luaM_newvector(S->L,n,Proto*);
  f->sizep=n;
  for (i=0; i<n; i++) f->p[i]=NULL;
- for (i=0; i<n; i++) f->p[i]=LoadFunction(S,f->source);
+ for (i=0; i<n; i++)
+  f->p[i]=S->inplace ? LoadStub(S,f->source) : LoadFunction(S,f->source);
 }
 
 static void LoadDebug(LoadState* S, Proto* f)
 {
  int i,n;
  n=LoadInt(S);
- f->lineinfo=luaM_newvector(S->L,n,int);
- f->sizelineinfo=n;
- LoadVector(S,f->lineinfo,n,sizeof(int));
+ LoadPad(S);
+ if (f->inimage)
+ {
+  f->lineinfo=cast(int*,LoadInPlace(S,n,sizeof(int)));
+  f->sizelineinfo=n;
+ }
+ else
+ {
+  f->lineinfo=luaM_newvector(S->L,n,int);
+  f->sizelineinfo=n;
+  LoadVector(S,f->lineinfo,n,sizeof(int));
+ }
  n=LoadInt(S);
  f->locvars=luaM_newvector(S->L,n,LocVar);
  f->sizelocvars=n;
@@ -164,6 +216,7 @@ static Proto* LoadFunction(LoadState* S, TString* p)
  if (++S->L->nCcalls > LUAI_MAXCCALLS) error(S,"code too deep");
  f=luaF_newproto(S->L);
  setptvalue2s(S->L,S->L->top,f); incr_top(S->L);
+ f->inimage=cast_byte(S->inplace);
  f->source=LoadString(S); if (f->source==NULL) f->source=p;
  f->linedefined=LoadInt(S);
  f->lastlinedefined=LoadInt(S);
@@ -180,34 +233,152 @@ static Proto* LoadFunction(LoadState* S, TString* p)
  return f;
 }
 
+/*
+** Nested functions of an image used in place are loaded lazily: they are
+** only checked and skipped, leaving a stub with the place of the function
+** in the image and the fields its parent needs; `luaU_loadnested' loads
+** it when a closure is first made for it.
+*/
+
+static void SkipString(LoadState* S)
+{
+ size_t size;
+ LoadVar(S,size);
+ LoadInPlace(S,size,1);
+}
+
+/* skip a function, reading only its header into `f' */
+static void SkipFunction(LoadState* S, Proto* f)
+{
+ int i,n;
+ if (++S->L->nCcalls > LUAI_MAXCCALLS) error(S,"code too deep");
+ SkipString(S);
+ f->linedefined=LoadInt(S);
+ f->lastlinedefined=LoadInt(S);
+ f->nups=LoadByte(S);
+ f->numparams=LoadByte(S);
+ f->is_vararg=LoadByte(S);
+ f->maxstacksize=LoadByte(S);
+ n=LoadInt(S);
+ LoadPad(S);
+ LoadInPlace(S,n,sizeof(Instruction));
+ n=LoadInt(S);
+ for (i=0; i<n; i++)
+ {
+  switch (LoadChar(S))
+  {
+   case LUA_TNIL:
+	break;
+   case LUA_TBOOLEAN:
+	LoadChar(S);
+	break;
+   case LUA_TNUMBER:
+	LoadNumber(S);
+	break;
+   case LUA_TSTRING:
+	SkipString(S);
+	break;
+   default:
+	error(S,"bad constant");
+	break;
+  }
+ }
+ n=LoadInt(S);
+ for (i=0; i<n; i++)
+ {
+  Proto g;
+  SkipFunction(S,&g);
+ }
+ n=LoadInt(S);
+ LoadPad(S);
+ LoadInPlace(S,n,sizeof(int));
+ n=LoadInt(S);
+ for (i=0; i<n; i++)
+ {
+  SkipString(S);
+  LoadInt(S);
+  LoadInt(S);
+ }
+ n=LoadInt(S);
+ for (i=0; i<n; i++) SkipString(S);
+ S->L->nCcalls--;
+}
+
+static Proto* LoadStub(LoadState* S, TString* p)
+{
+ Proto* f=luaF_newproto(S->L);
+ setptvalue2s(S->L,S->L->top,f); incr_top(S->L);
+ f->source=p;
+ f->lazy=S->Z->p;
+ SkipFunction(S,f);
+ f->sizelazy=S->Z->p-f->lazy;
+ S->L->top--;
+ return f;
+}
+
 static void LoadHeader(LoadState* S)
 {
  char h[LUAC_HEADERSIZE];
  char s[LUAC_HEADERSIZE];
  luaU_header(h);
  LoadBlock(S,s,LUAC_HEADERSIZE);
+ S->aligned=(s[LUAC_FORMATOFFSET]==LUAC_IMAGEFORMAT);
+ if (S->aligned) h[LUAC_FORMATOFFSET]=LUAC_IMAGEFORMAT;
  IF (memcmp(h,s,LUAC_HEADERSIZE)!=0, "bad header");
 }
 
-/*
-** load precompiled chunk
-*/
-Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name)
+static const char* ChunkName(const char* name)
 {
- LoadState S;
  if (*name=='@' || *name=='=')
-  S.name=name+1;
+  return name+1;
  else if (*name==LUA_SIGNATURE[0])
-  S.name="binary string";
+  return "binary string";
  else
-  S.name=name;
+  return name;
+}
+
+/*
+** load precompiled chunk; if `image', Z holds all of it in memory, which
+** stays unchanged while its functions live, so that the code and line
+** info of an image can be used in place
+*/
+Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name, int image)
+{
+ LoadState S;
+ S.name=ChunkName(name);
  S.L=L;
  S.Z=Z;
  S.b=buff;
+ S.pos=0;
  LoadHeader(&S);
+ S.inplace=image && S.aligned &&
+	   IntPoint(Z->p-S.pos)%LUAC_IMAGEALIGN==0;	/* aligned in memory? */
  return LoadFunction(&S,luaS_newliteral(L,"=?"));
 }
 
+/*
+** load the nested function `i' of `f', left as a stub by a lazy load
+*/
+Proto* luaU_loadnested (lua_State* L, Proto* f, int i)
+{
+ Proto* stub=f->p[i];
+ Proto* p;
+ ZIO Z;
+ LoadState S;
+ luaZ_initblock(L,&Z,stub->lazy,stub->sizelazy);
+ S.name=ChunkName(getstr(f->source));
+ S.L=L;
+ S.Z=&Z;
+ S.b=NULL;				/* strings are read in place */
+ S.pos=IntPoint(stub->lazy);		/* (only its alignment matters) */
+ S.aligned=S.inplace=1;
+ p=LoadFunction(&S,f->source);
+ if (p->nups!=stub->nups) error(&S,"bad code");
+ f->p[i]=p;
+ luaC_objbarrier(L,f,p);
+ return p;
+}
+
 /*
 * make header
 */
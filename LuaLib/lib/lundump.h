@@ -11,13 +11,16 @@
 #include "lzio.h"
 
 /* load one chunk; from lundump.c */
-LUAI_FUNC Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name);
+LUAI_FUNC Proto* luaU_undump (lua_State* L, ZIO* Z, Mbuffer* buff, const char* name, int image);
+
+/* load a nested function left unloaded; from lundump.c */
+LUAI_FUNC Proto* luaU_loadnested (lua_State* L, Proto* f, int i);
 
 /* make header; from lundump.c */
 LUAI_FUNC void luaU_header (char* h);
 
 /* dump one chunk; from ldump.c */
-LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip);
+LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, int image);
 
 #ifdef luac_c
 /* print one chunk; from print.c */
@@ -30,6 +33,15 @@ LUAI_FUNC void luaU_print (const Proto* f, int full);
 /* for header of binary files -- this is the official format */
 #define LUAC_FORMAT		0
 
+/* for header of binary files -- an image, with aligned vectors */
+#define LUAC_IMAGEFORMAT	LUA_IMAGEFORMAT
+
+/* position of the format in the header */
+#define LUAC_FORMATOFFSET	5
+
+/* alignment of code and line info in images, from the start of the chunk */
+#define LUAC_IMAGEALIGN		8
+
 /* size of header of binary files */
 #define LUAC_HEADERSIZE		12
 
@@ -0,0 +1,345 @@
+/*
+** $Id: lutf8lib.c $
+** Standard library for UTF-8 manipulation
+** See Copyright Notice in lua.h
+*/
+
+
+#include <limits.h>
+#include <string.h>
+
+#define lutf8lib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#define MAXUNICODE	0x10FFFF
+
+#define iscont(p)	((*(p) & 0xC0) == 0x80)
+
+/* maximum length of the UTF-8 encoding of a code point */
+#define UTF8BUFFSZ	8
+
+
+/* translate a relative string position: negative means back from end */
+static lua_Integer u_posrelat (lua_Integer pos, size_t len) {
+  if (pos >= 0) return pos;
+  else if (0u - (size_t)pos > len) return 0;
+  else return (lua_Integer)len + pos + 1;
+}
+
+
+/*
+** Text is mostly ASCII, so runs of ASCII characters are skipped a block
+** at a time: 16 bytes with LUA_USE_SSE2, otherwise a word, checking the
+** high bit of all its bytes at once.
+*/
+
+#if defined(LUA_USE_SSE2)
+#include <emmintrin.h>
+#endif
+
+/* a word with the high bit of each byte set */
+#define HIGHBITS	((~(size_t)0 / 0xFF) * 0x80)
+
+
+/* returns the end of the run of ASCII characters starting at `s' */
+static const char *skipascii (const char *s, const char *e) {
+#if defined(LUA_USE_SSE2)
+  for (; e - s >= 16; s += 16) {
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i *)s));
+    if (mask != 0)
+      return s + __builtin_ctz(mask);
+  }
+#endif
+  for (; e - s >= (ptrdiff_t)sizeof(size_t); s += sizeof(size_t)) {
+    size_t w;
+    memcpy(&w, s, sizeof(w));
+    if (w & HIGHBITS) break;
+  }
+  while (s < e && (unsigned char)*s < 0x80) s++;
+  return s;
+}
+
+
+/*
+** Decode one UTF-8 sequence, returning NULL if byte sequence is invalid
+** (overlong encodings, surrogates, and codes above MAXUNICODE included).
+*/
+static const char *utf8_decode (const char *o, int *val) {
+  static const unsigned int limits[] = {0xFF, 0x7F, 0x7FF, 0xFFFF};
+  const unsigned char *s = (const unsigned char *)o;
+  unsigned int c = s[0];
+  unsigned int res = 0;  /* final result */
+  if (c < 0x80)  /* ascii? */
+    res = c;
+  else {
+    int count = 0;  /* to count number of continuation bytes */
+    while (c & 0x40) {  /* still have continuation bytes? */
+      int cc = s[++count];  /* read next byte */
+      if ((cc & 0xC0) != 0x80)  /* not a continuation byte? */
+        return NULL;  /* invalid byte sequence */
+      res = (res << 6) | (cc & 0x3F);  /* add lower 6 bits from cont. byte */
+      c <<= 1;  /* to test next bit */
+    }
+    res |= ((c & 0x7F) << (count * 5));  /* add first byte */
+    if (count > 3 || res > MAXUNICODE || res <= limits[count] ||
+        (0xD800 <= res && res <= 0xDFFF))
+      return NULL;  /* invalid byte sequence */
+    s += count;  /* skip continuation bytes read */
+  }
+  if (val) *val = res;
+  return (const char *)s + 1;  /* +1 to include first byte */
+}
+
+
+/*
+** counts the characters that start in [s + posi, s + posj]; returns -1
+** (with the position of the bad sequence in `*posi') if they are not
+** well formed
+*/
+static lua_Integer countchars (const char *s, lua_Integer *posi,
+                               lua_Integer posj) {
+  lua_Integer n = 0;
+  lua_Integer i = *posi;
+  while (i <= posj) {
+    const char *s1;
+    if ((unsigned char)s[i] < 0x80) {  /* ASCII run? */
+      s1 = skipascii(s + i, s + posj + 1);
+      n += (s1 - s) - i;
+    }
+    else {
+      s1 = utf8_decode(s + i, NULL);
+      if (s1 == NULL) {  /* conversion error? */
+        *posi = i;
+        return -1;
+      }
+      n++;
+    }
+    i = s1 - s;
+  }
+  return n;
+}
+
+
+/*
+** utf8len(s [, i [, j]]) --> number of characters that start in the
+** range [i,j], or nil + current position if `s' is not well formed in
+** that interval
+*/
+static int utflen (lua_State *L) {
+  lua_Integer n;
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+  lua_Integer posi = u_posrelat(luaL_optinteger(L, 2, 1), len);
+  lua_Integer posj = u_posrelat(luaL_optinteger(L, 3, -1), len);
+  luaL_argcheck(L, 1 <= posi && --posi <= (lua_Integer)len, 2,
+                   "initial position out of string");
+  luaL_argcheck(L, --posj < (lua_Integer)len, 3,
+                   "final position out of string");
+  n = countchars(s, &posi, posj);
+  if (n < 0) {
+    lua_pushnil(L);  /* return nil ... */
+    lua_pushinteger(L, posi + 1);  /* ... and current position */
+    return 2;
+  }
+  lua_pushinteger(L, n);
+  return 1;
+}
+
+
+/* valid(s) --> true if `s' is well-formed UTF-8 */
+static int utfvalid (lua_State *L) {
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+  lua_Integer posi = 0;
+  lua_pushboolean(L, countchars(s, &posi, (lua_Integer)len - 1) >= 0);
+  return 1;
+}
+
+
+/*
+** codepoint(s, [i, [j]])  -> returns codepoints for all characters
+** that start in the range [i,j]
+*/
+static int codepoint (lua_State *L) {
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+  lua_Integer posi = u_posrelat(luaL_optinteger(L, 2, 1), len);
+  lua_Integer pose = u_posrelat(luaL_optinteger(L, 3, posi), len);
+  int n;
+  const char *se;
+  luaL_argcheck(L, posi >= 1, 2, "out of range");
+  luaL_argcheck(L, pose <= (lua_Integer)len, 3, "out of range");
+  if (posi > pose) return 0;  /* empty interval; return no values */
+  if (pose - posi >= INT_MAX)  /* (lua_Integer -> int) overflow? */
+    return luaL_error(L, "string slice too long");
+  n = (int)(pose -  posi) + 1;
+  luaL_checkstack(L, n, "string slice too long");
+  n = 0;
+  se = s + pose;
+  for (s += posi - 1; s < se;) {
+    int code;
+    s = utf8_decode(s, &code);
+    if (s == NULL)
+      return luaL_error(L, "invalid UTF-8 code");
+    lua_pushinteger(L, code);
+    n++;
+  }
+  return n;
+}
+
+
+/*
+** encodes `x' into the end of `buff'; returns the number of bytes
+*/
+static int utf8esc (char *buff, unsigned long x) {
+  int n = 1;  /* number of bytes put in buffer (backwards) */
+  if (x < 0x80)  /* ascii? */
+    buff[UTF8BUFFSZ - 1] = (char)x;
+  else {  /* need continuation bytes */
+    unsigned int mfb = 0x3f;  /* maximum that fits in first byte */
+    do {  /* add continuation bytes */
+      buff[UTF8BUFFSZ - (n++)] = (char)(0x80 | (x & 0x3f));
+      x >>= 6;  /* remove added bits */
+      mfb >>= 1;  /* now there is one less bit available in first byte */
+    } while (x > mfb);  /* still needs continuation byte? */
+    buff[UTF8BUFFSZ - n] = (char)((~mfb << 1) | x);  /* add first byte */
+  }
+  return n;
+}
+
+
+static void addutfchar (lua_State *L, luaL_Buffer *b, int arg) {
+  char buff[UTF8BUFFSZ];
+  int n;
+  lua_Integer code = luaL_checkinteger(L, arg);
+  luaL_argcheck(L, 0 <= code && code <= MAXUNICODE, arg, "value out of range");
+  n = utf8esc(buff, (unsigned long)code);
+  luaL_addlstring(b, buff + UTF8BUFFSZ - n, n);
+}
+
+
+/*
+** utfchar(n1, n2, ...)  -> char(n1)..char(n2)...
+*/
+static int utfchar (lua_State *L) {
+  int n = lua_gettop(L);  /* number of arguments */
+  int i;
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= n; i++)
+    addutfchar(L, &b, i);
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+/*
+** offset(s, n, [i])  -> index where n-th character counting from
+**   position `i' starts; 0 means character at `i'.
+*/
+static int byteoffset (lua_State *L) {
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+  lua_Integer n  = luaL_checkinteger(L, 2);
+  lua_Integer posi = (n >= 0) ? 1 : (lua_Integer)len + 1;
+  posi = u_posrelat(luaL_optinteger(L, 3, posi), len);
+  luaL_argcheck(L, 1 <= posi && --posi <= (lua_Integer)len, 3,
+                   "position out of range");
+  if (n == 0) {
+    /* find beginning of current byte sequence */
+    while (posi > 0 && iscont(s + posi)) posi--;
+  }
+  else {
+    if (iscont(s + posi))
+      luaL_error(L, "initial position is a continuation byte");
+    if (n < 0) {
+       while (n < 0 && posi > 0) {  /* move back */
+         do {  /* find beginning of previous character */
+           posi--;
+         } while (posi > 0 && iscont(s + posi));
+         n++;
+       }
+     }
+     else {
+       n--;  /* do not move for 1st character */
+       while (n > 0 && posi < (lua_Integer)len) {
+         do {  /* find beginning of next character */
+           posi++;
+         } while (iscont(s + posi));  /* (cannot pass final '\0') */
+         n--;
+       }
+     }
+  }
+  if (n == 0)  /* did it find given character? */
+    lua_pushinteger(L, posi + 1);
+  else  /* no such character */
+    lua_pushnil(L);
+  return 1;
+}
+
+
+static int iter_aux (lua_State *L) {
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+  lua_Integer n = lua_tointeger(L, 2) - 1;
+  if (n < 0)  /* first iteration? */
+    n = 0;  /* start from here */
+  else if (n < (lua_Integer)len) {
+    n++;  /* skip current byte */
+    while (iscont(s + n)) n++;  /* and its continuations */
+  }
+  if (n >= (lua_Integer)len)
+    return 0;  /* no more codepoints */
+  else {
+    int code;
+    const char *next = utf8_decode(s + n, &code);
+    if (next == NULL)
+      return luaL_error(L, "invalid UTF-8 code");
+    lua_pushinteger(L, n + 1);
+    lua_pushinteger(L, code);
+    return 2;
+  }
+}
+
+
+static int iter_codes (lua_State *L) {
+  luaL_checkstring(L, 1);
+  lua_pushcfunction(L, iter_aux);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 0);
+  return 3;
+}
+
+
+/* pattern to match a single UTF-8 character (`%z' stands for '\0') */
+#define UTF8PATT	"[%z\x01-\x7F\xC2-\xF4][\x80-\xBF]*"
+
+
+static const luaL_Reg funcs[] = {
+  {"char", utfchar},
+  {"codepoint", codepoint},
+  {"codes", iter_codes},
+  {"len", utflen},
+  {"offset", byteoffset},
+  {"valid", utfvalid},
+  {NULL, NULL}
+};
+
+
+/*
+** Open UTF-8 library
+*/
+LUALIB_API int luaopen_utf8 (lua_State *L) {
+  luaL_register(L, LUA_UTF8LIBNAME, funcs);
+  lua_pushliteral(L, UTF8PATT);
+  lua_setfield(L, -2, "charpattern");
+  return 1;
+}
+
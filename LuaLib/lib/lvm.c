@@ -24,6 +24,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 #include "lvm.h"
 
 
@@ -50,8 +51,8 @@ int luaV_tostring (lua_State *L, StkId obj) {
   else {
     char s[LUAI_MAXNUMBER2STR];
     lua_Number n = nvalue(obj);
-    lua_number2str(s, n);
-    setsvalue2s(L, obj, luaS_new(L, s));
+    int l = luaO_num2str(s, n);
+    setsvalue2s(L, obj, luaS_newlstr(L, s, l));
     return 1;
   }
 }
@@ -105,6 +106,62 @@ static void callTM (lua_State *L, const TValue *f, const TValue *p1,
 }
 
 
+/*
+** returns the address of element `key' of typed array `u', or NULL
+** when `key' is not a valid (integral, 1-based) index
+*/
+static void *taelement (Udata *u, const TValue *key) {
+  lua_Number n = nvalue(key);
+  size_t esize = tasize(u->uv.atype);
+  int i;
+  lua_number2int(i, n);
+  if (luai_numeq(cast_num(i), n) && i >= 1 &&
+      cast(size_t, i) <= u->uv.len / esize)
+    return cast(char *, u + 1) + (i - 1) * esize;
+  return NULL;
+}
+
+
+static void tagetelement (Udata *u, const TValue *key, StkId val) {
+  void *p = taelement(u, key);
+  if (p == NULL)
+    setnilvalue(val);
+  else switch (u->uv.atype) {
+    case LUA_TAFLOAT64: setnvalue(val, cast_num(*cast(double *, p))); break;
+    case LUA_TAFLOAT32: setnvalue(val, cast_num(*cast(float *, p))); break;
+    case LUA_TAINT32: setnvalue(val, cast_num(*cast(LUAI_INT32 *, p))); break;
+    default: setnvalue(val, cast_num(*cast(unsigned char *, p))); break;
+  }
+}
+
+
+static void tasetelement (lua_State *L, Udata *u, const TValue *key,
+                          const TValue *val) {
+  TValue temp;
+  const TValue *v = val;
+  void *p = taelement(u, key);
+  int i;
+  if (p == NULL)
+    luaG_runerror(L, "typed array index out of range");
+  if (!tonumber(v, &temp))
+    luaG_runerror(L, "number expected, got %s", luaT_typenames[ttype(val)]);
+  switch (u->uv.atype) {
+    case LUA_TAFLOAT64: *cast(double *, p) = nvalue(v); break;
+    case LUA_TAFLOAT32: *cast(float *, p) = cast(float, nvalue(v)); break;
+    case LUA_TAINT32: {
+      lua_number2int(i, nvalue(v));
+      *cast(LUAI_INT32 *, p) = i;
+      break;
+    }
+    default: {
+      lua_number2int(i, nvalue(v));
+      *cast(unsigned char *, p) = cast(unsigned char, i);
+      break;
+    }
+  }
+}
+
+
 void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
@@ -119,6 +176,10 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
       }
       /* else will try the tag method */
     }
+    else if (istypedarray(t) && ttisnumber(key)) {  /* array element? */
+      tagetelement(rawuvalue(t), key, val);
+      return;
+    }
     else if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_INDEX)))
       luaG_typeerror(L, t, "index");
     if (ttisfunction(tm)) {
@@ -155,6 +216,10 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
       }
       /* else will try the tag method */
     }
+    else if (istypedarray(t) && ttisnumber(key)) {  /* array element? */
+      tasetelement(L, rawuvalue(t), key, val);
+      return;
+    }
     //如果元表为nil，报错。
     else if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_NEWINDEX)))
       luaG_typeerror(L, t, "index");
@@ -269,6 +334,7 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
     case LUA_TNUMBER: return luai_numeq(nvalue(t1), nvalue(t2));
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING: return luaS_eqstr(rawtsvalue(t1), rawtsvalue(t2));
     case LUA_TUSERDATA: {
       if (uvalue(t1) == uvalue(t2)) return 1;
       tm = get_compTM(L, uvalue(t1)->metatable, uvalue(t2)->metatable,
@@ -734,6 +800,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         Closure *ncl;
         int nup, j;
         p = cl->p->p[GETARG_Bx(i)];
+        if (p->lazy) {  /* not loaded yet? */
+          Protect(p = luaU_loadnested(L, cl->p, GETARG_Bx(i)));
+          ra = RA(i);
+        }
         nup = p->nups;
         ncl = luaF_newLclosure(L, nup, cl->env);
         ncl->l.p = p;
@@ -54,6 +54,20 @@ void luaZ_init (lua_State *L, ZIO *z, lua_Reader reader, void *data) {
 }
 
 
+static const char *noreader (lua_State *L, void *data, size_t *size) {
+  UNUSED(L); UNUSED(data); UNUSED(size);
+  return NULL;
+}
+
+
+/* a stream over a block of memory, read in place */
+void luaZ_initblock (lua_State *L, ZIO *z, const char *s, size_t size) {
+  luaZ_init(L, z, noreader, NULL);
+  z->n = size;
+  z->p = s;
+}
+
+
 /* --------------------------------------------------------------- read --- */
 size_t luaZ_read (ZIO *z, void *b, size_t n) {
   while (n) {
@@ -46,6 +46,8 @@ typedef struct Mbuffer {
 LUAI_FUNC char *luaZ_openspace (lua_State *L, Mbuffer *buff, size_t n);
 LUAI_FUNC void luaZ_init (lua_State *L, ZIO *z, lua_Reader reader,
                                         void *data);
+LUAI_FUNC void luaZ_initblock (lua_State *L, ZIO *z, const char *s,
+                                             size_t size);
 LUAI_FUNC size_t luaZ_read (ZIO* z, void* b, size_t n);	/* read next n bytes */
 LUAI_FUNC int luaZ_lookahead (ZIO *z);
 
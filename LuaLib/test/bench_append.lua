@@ -0,0 +1,60 @@
+-- benchmark: append-heavy code, where each `#t' used to cost a binary
+-- search of the array part (see the border hint in luaH_getn).
+-- usage: lua bench_append.lua [n [rounds]]
+--
+-- Results (x86-64, gcc -O2, n = 200000, 20 rounds, ns per operation,
+-- best of 2 runs):
+--                              without hint   with hint
+--   t[#t+1] = v                     80.5         26.6
+--   table.insert(t, v)              83.5         32.7
+--   append, then pop all           245.1         81.1
+--   append/pop interleaved         192.4         53.1
+--   table.insert/remove            218.7         91.3
+
+local n = tonumber(arg and arg[1]) or 200000
+local rounds = tonumber(arg and arg[2]) or 20
+
+local function time (name, f)
+  local start = os.clock()
+  for r = 1, rounds do f() end
+  local t = os.clock() - start
+  print(string.format("%-26s %.3fs (%.1f ns/op)", name, t,
+                      t * 1e9 / (n * rounds)))
+end
+
+time("t[#t+1] = v", function ()
+  local t = {}
+  for i = 1, n do t[#t + 1] = i end
+  assert(#t == n)
+end)
+
+time("table.insert(t, v)", function ()
+  local t = {}
+  local insert = table.insert
+  for i = 1, n do insert(t, i) end
+  assert(#t == n)
+end)
+
+time("append, then pop all", function ()
+  local t = {}
+  for i = 1, n do t[#t + 1] = i end
+  for i = n, 1, -1 do assert(t[#t] == i); t[#t] = nil end
+  assert(#t == 0)
+end)
+
+time("append/pop interleaved", function ()
+  local t = {1}
+  for i = 1, n do
+    t[#t + 1] = i
+    t[#t + 1] = i
+    t[#t] = nil
+  end
+  assert(#t == n + 1)
+end)
+
+time("table.insert/remove", function ()
+  local t = {}
+  local insert, remove = table.insert, table.remove
+  for i = 1, n do insert(t, i); insert(t, i); remove(t) end
+  assert(#t == n)
+end)
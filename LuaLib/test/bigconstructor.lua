@@ -0,0 +1,20 @@
+-- a table constructor with more than 511 SETLIST blocks stores each
+-- block count in an extra word after its SETLIST; with LUA_USE_OPTIMIZER
+-- those words must not be taken for jumps
+
+local n = 27000
+local t = {"return {"}
+for i = 1, n do t[#t + 1] = i .. "," end
+t[#t + 1] = "}"
+local f = assert(loadstring(table.concat(t)))
+local r = f()
+assert(#r == n)
+for i = 1, n do assert(r[i] == i) end
+
+-- with a function around the constructor and jumps next to it
+t[1] = "local a = ... if a then return {"
+t[#t] = "} else return a end"
+f = assert(loadstring(table.concat(t)))
+assert(#f(true) == n and f(false) == false)
+
+print("OK")
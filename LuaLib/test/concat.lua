@@ -0,0 +1,29 @@
+-- table.concat measures its result first; a large result of strings is
+-- written directly into the new string (lua_newstring), with no copy
+
+local big = string.rep("x", 5000)
+assert(table.concat({big, big}, ",") == big .. "," .. big)
+assert(table.concat({1, 2, 3}, ", ") == "1, 2, 3")
+assert(not pcall(table.concat, {big, {}}))
+
+local t, u = {}, {}
+for i = 1, 3000 do t[i] = i * 1.5; u[i] = tostring(i * 1.5) end
+assert(table.concat(t, " ") == table.concat(u, " "))
+t = {}
+for i = 1, 1000 do t[i] = "ab" end
+local s = table.concat(t, "", 2, 999)
+assert(s == string.rep("ab", 998))
+local h = {[s] = true}  -- (hashed only now, after it was written)
+assert(h[string.rep("ab", 998)])
+
+-- the result of strings is not held twice at peak
+collectgarbage()
+collectgarbage("stop")
+local piece = string.rep("y", 1024)
+t = {}
+for i = 1, 8192 do t[i] = piece end
+local before = collectgarbage("count")
+local r = table.concat(t)
+assert(collectgarbage("count") - before < 8 * 1024 + 64)
+assert(r == string.rep(piece, 8192))
+collectgarbage("restart")
@@ -0,0 +1,113 @@
+-- differential test for LUA_USE_OPTIMIZER: random functions full of
+-- comparisons between constants, nested branches and loops with breaks
+-- must give the same results when run directly, after a string.dump/
+-- loadstring round trip, and (if given) under a reference interpreter
+-- built without the optimizer.
+-- usage: lua optimizer.lua [count [first-seed [reference-lua]]]
+
+local count = tonumber(arg and arg[1]) or 200
+local first = tonumber(arg and arg[2]) or 1
+local reference = arg and arg[3]
+
+
+-- a few cases with known results
+local function check (src, expected)
+  local f = assert(loadstring(src))
+  local g = assert(loadstring(string.dump(f)))
+  assert(f() == expected, src)
+  assert(g() == expected, src)
+end
+
+check("if 1 == 1 then return 'y' else return 'n' end", "y")
+check("if 1 ~= 1 then return 'y' else return 'n' end", "n")
+check("if 1 < 2 then return 'y' else return 'n' end", "y")
+check("if 2 <= 1 then return 'y' else return 'n' end", "n")
+check("if nil == false then return 'y' else return 'n' end", "n")
+check("if 'a' == 'a' then return 'y' else return 'n' end", "y")
+check("if 'a' < 'b' then return 'y' else return 'n' end", "y")
+check("return (1 == 1) and 'y' or 'n'", "y")
+check("return not (1 < 1) and 'y' or 'n'", "y")
+check("local x = 0 while 1 < 2 do x = x + 1 if x > 3 then break end end " ..
+      "return x", 4)
+check("local x = 0 repeat x = x + 1 until 2 <= 1 or x == 5 return x", 5)
+assert(not pcall(loadstring("if {} < 1 then end")))
+assert(not pcall(loadstring("if 'a' < 1 then end")))
+
+
+-- random programs
+local consts = {"1", "2", "nil", "false", "true", "'a'", "'b'", "x", "y", "i"}
+local nums = {"1", "2", "x", "3"}
+
+local function pick (t) return t[math.random(#t)] end
+
+local function cond (d)
+  local r = math.random(6)
+  if r == 1 or d > 2 then
+    if math.random(2) == 1 then
+      return pick(consts) .. pick{" == ", " ~= "} .. pick(consts)
+    end
+    return pick(nums) .. pick{" < ", " <= ", " > ", " >= "} .. pick(nums)
+  elseif r == 2 then return "not (" .. cond(d + 1) .. ")"
+  elseif r == 3 then return "(" .. cond(d + 1) .. ") and (" .. cond(d + 1) .. ")"
+  elseif r == 4 then return "(" .. cond(d + 1) .. ") or (" .. cond(d + 1) .. ")"
+  else return pick(consts)
+  end
+end
+
+local function block (out, d)
+  for k = 1, math.random(4) do
+    local r = (d > 3) and 1 or math.random(8)
+    local function emit (s) out[#out + 1] = s end
+    if r == 1 then emit("acc = acc .. '" .. k .. d .. "'")
+    elseif r == 2 then
+      emit("if " .. cond(0) .. " then"); block(out, d + 1)
+      emit("else"); block(out, d + 1); emit("end")
+    elseif r == 3 then
+      emit("if " .. cond(0) .. " then"); block(out, d + 1); emit("end")
+    elseif r == 4 then
+      emit("for i = 1, 3 do"); block(out, d + 1)
+      emit("if " .. cond(0) .. " then break end end")
+    elseif r == 5 then
+      emit("do local v = " .. cond(0) .. "; acc = acc .. tostring(v) end")
+    elseif r == 6 then
+      emit("for _, i in ipairs{1, 2} do"); block(out, d + 1); emit("end")
+    elseif r == 7 then
+      emit("do local n = 0 while " .. cond(0) ..
+           " do n = n + 1; acc = acc .. 'w'; if n > 2 then break end end end")
+    else emit("if " .. cond(0) .. " then return acc .. 'R' end")
+    end
+  end
+end
+
+local function program (seed)
+  math.randomseed(seed)
+  local out = {"local x, y = 1, 'a'", "local function f () local acc = ''"}
+  block(out, 0)
+  out[#out + 1] = "return acc end"
+  out[#out + 1] = "local ok, r = pcall(f) return tostring(ok) .. ' ' .. r"
+  return table.concat(out, "\n")
+end
+
+local tmp = reference and os.tmpname()
+for seed = first, first + count - 1 do
+  local src = program(seed)
+  local f = assert(loadstring(src))
+  local r = f()
+  local g = assert(loadstring(string.dump(f)))
+  if g() ~= r then
+    error("seed " .. seed .. ": dumped chunk differs\n" .. src)
+  end
+  if reference then
+    local h = assert(io.open(tmp, "w"))
+    h:write("io.write((function () ", src, " end)())")
+    h:close()
+    local p = assert(io.popen(reference .. " " .. tmp))
+    local rr = p:read("*a")
+    p:close()
+    if rr ~= r then
+      error("seed " .. seed .. ": '" .. r .. "' but reference gives '" ..
+            rr .. "'\n" .. src)
+    end
+  end
+end
+if tmp then os.remove(tmp) end
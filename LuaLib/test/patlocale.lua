@@ -0,0 +1,26 @@
+-- compiled patterns must follow the current locale, as interpreted ones
+-- do: `%a' compiled before os.setlocale must not keep the old classes
+
+local function classes (patt)
+  local t = {}
+  for c = 0, 255 do
+    t[#t + 1] = string.find(string.char(c), patt) and "1" or "0"
+  end
+  return table.concat(t)
+end
+
+local old = os.setlocale(nil, "ctype")
+local cached = {"%a", "%w", "[%l_]", "%U", "[^%d]"}
+for _, p in ipairs(cached) do classes(p) end  -- compile them
+for _, loc in ipairs{"C.UTF-8", "pt_BR.ISO-8859-1", "en_US.ISO-8859-1",
+                     "de_DE.ISO-8859-1", "C"} do
+  if os.setlocale(loc, "ctype") then
+    for _, p in ipairs(cached) do
+      -- `()' makes a new pattern, compiled in the current locale
+      assert(classes(p) == classes(p .. "()"), p .. " in " .. loc)
+    end
+  end
+end
+os.setlocale(old, "ctype")
+
+print("OK")
@@ -0,0 +1,23 @@
+-- the block of a string buffer is memory of the state, seen by the
+-- collector and released with the buffer
+
+collectgarbage()
+local before = collectgarbage("count")
+local b = string.buffer()
+local piece = string.rep("x", 1000)
+for i = 1, 1000 do b:add(piece) end
+assert(#b == 1000000 and b:tostring():sub(-3) == "xxx")
+assert(collectgarbage("count") - before > 1000)  -- (in Kbytes)
+b:reset():add("ab", 1, "c")
+assert(b:tostring() == "ab1c")
+b = nil
+collectgarbage()
+assert(collectgarbage("count") - before < 100)
+
+-- buffers do not share their environments
+local b1, b2 = string.buffer(10), string.buffer()
+b1:add("one") b2:add("two")
+assert(b1:tostring() == "one" and b2:tostring() == "two")
+assert(string.find("abc", "b") == 2)  -- (pattern cache untouched)
+
+print("OK")
@@ -0,0 +1,24 @@
+-- string.sub and string.split share long suffixes through
+-- lua_pushsubstring; run them while the GC keeps shrinking the stack
+
+local function deep (n)
+  if n > 0 then deep(n - 1) end  -- (not a tail call)
+end
+
+local s = string.rep("abcdefghij", 100)
+local parts = string.rep("x,", 500) .. string.rep("y", 1000)
+
+collectgarbage("setpause", 0)
+collectgarbage("setstepmul", 100000)
+for round = 1, 20 do
+  deep(5000)  -- grow the stack, so that the GC shrinks it again
+  for k = 1, #s do
+    assert(s:sub(k) == string.sub(s, k, -1))
+  end
+  local t = string.split(parts, ",")
+  assert(#t == 501 and t[501] == string.rep("y", 1000))
+end
+collectgarbage("setpause", 200)
+collectgarbage("setstepmul", 200)
+
+print("OK")